@@ -0,0 +1,88 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+#ifndef S2E_BENCH_H
+#define S2E_BENCH_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * Helpers shared by the standalone microbenchmarks in this directory.
+ * They are built with -DS2E_BUILD_BENCHMARKS=ON and do not need QEMU.
+ */
+
+namespace s2e {
+namespace bench {
+
+static inline uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Keeps the compiler from optimizing the measured work away */
+static inline void do_not_optimize(uint64_t value)
+{
+    asm volatile("" : : "r"(value) : "memory");
+}
+
+/** Runs f() iterations times and prints the average cost of one call */
+template<typename F>
+static double measure(const char *name, uint64_t iterations, F f)
+{
+    //Warm up caches and branch predictors
+    for (uint64_t i = 0; i < iterations / 10; ++i) {
+        f(i);
+    }
+
+    uint64_t start = now_ns();
+    for (uint64_t i = 0; i < iterations; ++i) {
+        f(i);
+    }
+    uint64_t end = now_ns();
+
+    double nsPerOp = (double) (end - start) / iterations;
+    printf("%-48s %10.2f ns/op\n", name, nsPerOp);
+    return nsPerOp;
+}
+
+}
+}
+
+#endif // S2E_BENCH_H
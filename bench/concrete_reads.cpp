@@ -0,0 +1,241 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+/**
+ * Models S2EExecutionState::readMemoryConcrete on 4 KB buffers.
+ * The byte-wise variant is the old loop: translate, look the object up
+ * and read one byte, for every byte. The run variant is the current one:
+ * translate once per guest page and memcpy fully concrete objects.
+ *
+ * The guest page table, the memory cache and the object store are
+ * simplified stand-ins for QEMU and KLEE. The old loop also built one
+ * ConstantExpr per byte, which is left out, so the speedup shown here
+ * is a lower bound.
+ */
+
+#include <s2e/MemoryCache.h>
+
+#include <vector>
+#include <string.h>
+#include <assert.h>
+#include <sys/mman.h>
+
+#include "Bench.h"
+
+using namespace s2e;
+using namespace s2e::bench;
+
+namespace {
+
+const unsigned PageBits = 12;
+const uint64_t PageSize = 1 << PageBits;
+const unsigned ObjectBits = 7;
+const uint64_t ObjectSize = 1 << ObjectBits;
+
+const uint64_t RamSize = 64 << 20;
+const uint64_t PageCount = RamSize >> PageBits;
+const uint64_t BufferSize = 4096;
+
+const uint64_t Iterations = 200000;
+
+/* Stand-in for a RAM ObjectState. Like KLEE, it only keeps a per-byte
+   mask once some byte became symbolic. */
+struct Object {
+    uint8_t concreteStore[ObjectSize];
+    bool hasSymbolicBytes;
+    uint8_t symbolicMask[ObjectSize / 8];
+
+    bool isByteConcrete(unsigned offset) const {
+        return !hasSymbolicBytes || !(symbolicMask[offset / 8] & (1 << (offset % 8)));
+    }
+
+    bool isConcrete(unsigned offset, unsigned size) const {
+        if (!hasSymbolicBytes) {
+            return true;
+        }
+        for (unsigned i = 0; i < size; ++i) {
+            if (!isByteConcrete(offset + i)) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+struct Entry {
+    Object *first;
+    void *second;
+
+    Entry() : first(NULL), second(NULL) {}
+
+    bool operator==(const Entry &other) const {
+        return first == other.first && second == other.second;
+    }
+};
+
+typedef MemoryCache<Entry, ObjectBits, PageBits, 20> ObjectCache;
+
+class Guest {
+private:
+    //Page-aligned, like the guest RAM blocks QEMU allocates
+    uint8_t *m_ram;
+    std::vector<Object> m_objects;
+
+    //Two-level table from guest virtual pages to host pages, in the
+    //spirit of the walk done by cpu_get_phys_page_debug
+    std::vector<std::vector<uint64_t> > m_pageTable;
+
+    ObjectCache m_cache;
+
+    uint64_t getHostAddress(uint64_t address) const {
+        uint64_t page = address >> PageBits;
+        const std::vector<uint64_t> &pte = m_pageTable[page >> 10];
+        return pte[page & 1023] | (address & (PageSize - 1));
+    }
+
+    const Object *getObject(uint64_t hostAddress) {
+        uint64_t objectAddress = hostAddress & ~(ObjectSize - 1);
+        Entry entry = m_cache.get(objectAddress);
+        if (!entry.first) {
+            entry.first = &m_objects[(objectAddress - getRamStart()) >> ObjectBits];
+            m_cache.put(objectAddress, entry);
+        }
+        return entry.first;
+    }
+
+    uint64_t getRamStart() const {
+        return (uint64_t) m_ram;
+    }
+
+public:
+    Guest() : m_ram((uint8_t*) mmap(NULL, RamSize, PROT_READ | PROT_WRITE,
+                                    MAP_PRIVATE | MAP_ANON, -1, 0)),
+              m_objects(RamSize >> ObjectBits),
+              m_pageTable((PageCount + 1023) / 1024, std::vector<uint64_t>(1024)),
+              m_cache((uint64_t) m_ram, RamSize)
+    {
+        assert(m_ram != MAP_FAILED);
+        memset(&m_objects[0], 0, m_objects.size() * sizeof(Object));
+
+        //Scatter the guest pages over the host RAM
+        for (uint64_t page = 0; page < PageCount; ++page) {
+            uint64_t hostPage = (page * 40503) % PageCount;
+            m_pageTable[page >> 10][page & 1023] = getRamStart() + (hostPage << PageBits);
+        }
+    }
+
+    bool readByteWise(uint64_t address, uint8_t *buf, uint64_t size) {
+        for (uint64_t i = 0; i < size; ++i) {
+            uint64_t hostAddress = getHostAddress(address + i);
+            const Object *object = getObject(hostAddress);
+            unsigned offset = hostAddress & (ObjectSize - 1);
+            if (!object->isByteConcrete(offset)) {
+                return false;
+            }
+            buf[i] = object->concreteStore[offset];
+        }
+        return true;
+    }
+
+    bool readRuns(uint64_t address, uint8_t *buf, uint64_t size) {
+        while (size > 0) {
+            uint64_t length = PageSize - (address & (PageSize - 1));
+            if (length > size) {
+                length = size;
+            }
+
+            uint64_t hostAddress = getHostAddress(address);
+            uint64_t remaining = length;
+            uint8_t *d = buf;
+            while (remaining > 0) {
+                unsigned offset = hostAddress & (ObjectSize - 1);
+                uint64_t chunk = ObjectSize - offset;
+                if (chunk > remaining) {
+                    chunk = remaining;
+                }
+
+                const Object *object = getObject(hostAddress);
+                if (!object->isConcrete(offset, chunk)) {
+                    return false;
+                }
+                memcpy(d, object->concreteStore + offset, chunk);
+
+                remaining -= chunk;
+                d += chunk;
+                hostAddress += chunk;
+            }
+
+            size -= length;
+            buf += length;
+            address += length;
+        }
+        return true;
+    }
+};
+
+}
+
+int main()
+{
+    Guest guest;
+    uint8_t buffer[BufferSize];
+
+    //Buffers start at pseudo-random guest addresses, either page-aligned
+    //or at an offset that makes them span two pages
+    const uint64_t slots = PageCount - 1;
+
+    measure("byte-wise, 4 KB page-aligned", Iterations, [&](uint64_t i) {
+        uint64_t address = ((i * 7919) % slots) << PageBits;
+        do_not_optimize(guest.readByteWise(address, buffer, BufferSize) + buffer[0]);
+    });
+
+    measure("per page run, 4 KB page-aligned", Iterations, [&](uint64_t i) {
+        uint64_t address = ((i * 7919) % slots) << PageBits;
+        do_not_optimize(guest.readRuns(address, buffer, BufferSize) + buffer[0]);
+    });
+
+    measure("byte-wise, 4 KB unaligned", Iterations, [&](uint64_t i) {
+        uint64_t address = (((i * 7919) % slots) << PageBits) + 1000;
+        do_not_optimize(guest.readByteWise(address, buffer, BufferSize) + buffer[0]);
+    });
+
+    measure("per page run, 4 KB unaligned", Iterations, [&](uint64_t i) {
+        uint64_t address = (((i * 7919) % slots) << PageBits) + 1000;
+        do_not_optimize(guest.readRuns(address, buffer, BufferSize) + buffer[0]);
+    });
+
+    return 0;
+}
@@ -0,0 +1,179 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+/**
+ * Compares the cost of a log line written through S2E::getStream when it
+ * flushed stdio and the target stream on every call, and now that it
+ * flushes all log files at most once per second. The streams are built
+ * like in S2E::initOutputDirectory: buffered files for debug.txt and
+ * messages.txt, and a raw_tee_ostream that writes to both.
+ */
+
+#include <s2e/Utils.h>
+
+#include <string>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "Bench.h"
+
+using namespace s2e;
+using namespace s2e::bench;
+
+namespace {
+
+const uint64_t Lines = 1000000;
+
+class LogStreams
+{
+public:
+    llvm::raw_fd_ostream *debugFile;
+    llvm::raw_fd_ostream *messagesFile;
+    llvm::raw_ostream *messages;
+
+    uint64_t startSeconds;
+    uint64_t lastFlushSeconds;
+
+    LogStreams(const std::string &directory) {
+        debugFile = open(directory + "/debug.txt");
+        messagesFile = open(directory + "/messages.txt");
+
+        raw_tee_ostream *tee = new raw_tee_ostream(messagesFile);
+        tee->addParentBuf(debugFile);
+        messages = tee;
+
+        startSeconds = lastFlushSeconds = now();
+    }
+
+    ~LogStreams() {
+        delete messages;
+        delete messagesFile;
+        delete debugFile;
+    }
+
+    static llvm::raw_fd_ostream *open(const std::string &path) {
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            perror(path.c_str());
+            exit(-1);
+        }
+        return new llvm::raw_fd_ostream(fd, true);
+    }
+
+    /* TimeValue::now() is a gettimeofday() call */
+    static uint64_t now() {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return tv.tv_sec;
+    }
+
+    void flushAll() {
+        fflush(stdout);
+        fflush(stderr);
+        debugFile->flush();
+        messagesFile->flush();
+    }
+
+    /** S2E::getStream before the change */
+    llvm::raw_ostream &getStreamAlwaysFlush(llvm::raw_ostream &stream) {
+        fflush(stdout);
+        fflush(stderr);
+        stream.flush();
+        stream << (now() - startSeconds) << ' ' << "[State 1] ";
+        return stream;
+    }
+
+    /** S2E::getStream after the change */
+    llvm::raw_ostream &getStreamRateLimited(llvm::raw_ostream &stream) {
+        uint64_t seconds = now();
+        if (seconds != lastFlushSeconds) {
+            lastFlushSeconds = seconds;
+            flushAll();
+        }
+        stream << (seconds - startSeconds) << ' ' << "[State 1] ";
+        return stream;
+    }
+};
+
+void report(const char *name, double nsPerLine)
+{
+    printf("%-48s %10.0f lines/s\n", name, 1e9 / nsPerLine);
+}
+
+}
+
+int main()
+{
+    char directory[] = "/tmp/s2e-bench-log-XXXXXX";
+    if (!mkdtemp(directory)) {
+        perror("mkdtemp");
+        return -1;
+    }
+
+    LogStreams streams(directory);
+
+    double ns;
+    ns = measure("debug.txt, flush on every line", Lines, [&](uint64_t i) {
+        streams.getStreamAlwaysFlush(*streams.debugFile) << "Executing block at pc " << i << '\n';
+    });
+    report("debug.txt, flush on every line", ns);
+
+    ns = measure("debug.txt, flush once per second", Lines, [&](uint64_t i) {
+        streams.getStreamRateLimited(*streams.debugFile) << "Executing block at pc " << i << '\n';
+    });
+    report("debug.txt, flush once per second", ns);
+
+    //The tee is unbuffered and does not flush its parents, so the old
+    //path only paid for the stdio flushes here
+    ns = measure("messages tee, flush on every line", Lines, [&](uint64_t i) {
+        streams.getStreamAlwaysFlush(*streams.messages) << "Executing block at pc " << i << '\n';
+    });
+    report("messages tee, flush on every line", ns);
+
+    ns = measure("messages tee, flush once per second", Lines, [&](uint64_t i) {
+        streams.getStreamRateLimited(*streams.messages) << "Executing block at pc " << i << '\n';
+    });
+    report("messages tee, flush once per second", ns);
+
+    streams.flushAll();
+    unlink((std::string(directory) + "/debug.txt").c_str());
+    unlink((std::string(directory) + "/messages.txt").c_str());
+    rmdir(directory);
+
+    return 0;
+}
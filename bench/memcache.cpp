@@ -0,0 +1,418 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+/**
+ * Compares the flat MemoryCache against the three-level cache it
+ * replaced, for a 1 GB guest RAM region with the S2EMemoryCache
+ * geometry. Reports the cost of a lookup and the memory the cache
+ * itself uses as more and more guest pages get touched.
+ *
+ * Also compares MemoryCachePool against the pool it replaced, which
+ * scanned its list of regions on every access, and the cost of cloning
+ * a pool against copying the resident pages of its array.
+ */
+
+#include <s2e/MemoryCache.h>
+
+#include <vector>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "Bench.h"
+
+using namespace s2e;
+using namespace s2e::bench;
+
+namespace {
+
+/* Same layout as klee::ObjectPair */
+struct Entry {
+    const void *first;
+    const void *second;
+
+    Entry() : first(NULL), second(NULL) {}
+
+    bool operator==(const Entry &other) const {
+        return first == other.first && second == other.second;
+    }
+};
+
+const unsigned ObjectBits = 7;
+const unsigned PageBits = 12;
+const unsigned SuperPageBits = 20;
+
+const uint64_t RamStart = 0x7f0000000000ULL;
+const uint64_t RamSize = 1ULL << 30;
+const uint64_t PageCount = RamSize >> PageBits;
+
+const uint64_t Iterations = 20000000;
+
+/**
+ * The cache MemoryCache used to be: a superpage table pointing to page
+ * tables, which point to heap-allocated arrays of entries.
+ */
+class LegacyMemoryCache
+{
+private:
+    struct ThirdLevel {
+        Entry level3[1 << (PageBits - ObjectBits)];
+    };
+
+    struct SecondLevel {
+        ThirdLevel *level2[1 << (SuperPageBits - PageBits)];
+
+        SecondLevel() {
+            for (unsigned i = 0; i < (1 << (SuperPageBits - PageBits)); ++i) {
+                level2[i] = NULL;
+            }
+        }
+
+        ~SecondLevel() {
+            for (unsigned i = 0; i < (1 << (SuperPageBits - PageBits)); ++i) {
+                delete level2[i];
+            }
+        }
+    };
+
+    SecondLevel **m_level1;
+    uint64_t m_hostAddrStart;
+    unsigned m_pagecount;
+
+public:
+    LegacyMemoryCache(uint64_t hostAddrStart, uint64_t size) {
+        m_hostAddrStart = hostAddrStart;
+        m_pagecount = (size + (1 << SuperPageBits) - 1) >> SuperPageBits;
+        m_level1 = new SecondLevel*[m_pagecount];
+        for (unsigned i = 0; i < m_pagecount; ++i) {
+            m_level1[i] = NULL;
+        }
+    }
+
+    ~LegacyMemoryCache() {
+        for (unsigned i = 0; i < m_pagecount; ++i) {
+            delete m_level1[i];
+        }
+        delete [] m_level1;
+    }
+
+    inline void put(uint64_t hostAddress, const Entry &obj) {
+        uint64_t offset = hostAddress - m_hostAddrStart;
+        uint64_t level1 = offset >> SuperPageBits;
+        uint64_t level2 = (offset & ((1 << SuperPageBits) - 1)) >> PageBits;
+        uint64_t level3 = (offset >> ObjectBits) & ((1 << (PageBits - ObjectBits)) - 1);
+
+        if (!m_level1[level1]) {
+            m_level1[level1] = new SecondLevel();
+        }
+
+        SecondLevel *ptrLevel2 = m_level1[level1];
+        if (!ptrLevel2->level2[level2]) {
+            ptrLevel2->level2[level2] = new ThirdLevel();
+        }
+
+        ptrLevel2->level2[level2]->level3[level3] = obj;
+    }
+
+    inline Entry get(uint64_t hostAddress) {
+        uint64_t offset = hostAddress - m_hostAddrStart;
+        uint64_t level1 = offset >> SuperPageBits;
+        uint64_t level2 = (offset & ((1 << SuperPageBits) - 1)) >> PageBits;
+        uint64_t level3 = (offset >> ObjectBits) & ((1 << (PageBits - ObjectBits)) - 1);
+
+        SecondLevel *ptrLevel2 = m_level1[level1];
+        if (!ptrLevel2) {
+            return Entry();
+        }
+
+        ThirdLevel *ptrLevel3 = ptrLevel2->level2[level2];
+        if (!ptrLevel3) {
+            return Entry();
+        }
+
+        return ptrLevel3->level3[level3];
+    }
+
+    /** Heap bytes held by the tables, not counting allocator overhead */
+    uint64_t getMemoryUsage() const {
+        uint64_t bytes = m_pagecount * sizeof(SecondLevel*);
+        for (unsigned i = 0; i < m_pagecount; ++i) {
+            if (!m_level1[i]) {
+                continue;
+            }
+            bytes += sizeof(SecondLevel);
+            for (unsigned j = 0; j < (1 << (SuperPageBits - PageBits)); ++j) {
+                if (m_level1[i]->level2[j]) {
+                    bytes += sizeof(ThirdLevel);
+                }
+            }
+        }
+        return bytes;
+    }
+};
+
+typedef MemoryCache<Entry, ObjectBits, PageBits, SuperPageBits> FlatMemoryCache;
+typedef MemoryCachePool<Entry, ObjectBits, PageBits, SuperPageBits> FlatMemoryCachePool;
+
+/** The pool lookup before the superpage map, regions sorted by size */
+class LinearMemoryCachePool
+{
+private:
+    std::vector<FlatMemoryCache*> m_caches;
+
+public:
+    ~LinearMemoryCachePool() {
+        for (unsigned i = 0; i < m_caches.size(); ++i) {
+            delete m_caches[i];
+        }
+    }
+
+    void registerPool(uint64_t hostAddrStart, uint64_t size) {
+        std::vector<FlatMemoryCache*>::iterator it = m_caches.begin();
+        for (; it != m_caches.end(); ++it) {
+            if (size > (*it)->getSize()) {
+                break;
+            }
+        }
+        m_caches.insert(it, new FlatMemoryCache(hostAddrStart, size));
+    }
+
+    void put(uint64_t hostAddress, const Entry &obj) {
+        for (unsigned i = 0; i < m_caches.size(); ++i) {
+            if (m_caches[i]->contains(hostAddress)) {
+                m_caches[i]->put(hostAddress, obj);
+                return;
+            }
+        }
+    }
+
+    Entry get(uint64_t hostAddress) {
+        for (unsigned i = 0; i < m_caches.size(); ++i) {
+            if (m_caches[i]->contains(hostAddress)) {
+                return m_caches[i]->get(hostAddress);
+            }
+        }
+        return Entry();
+    }
+};
+
+/** RAM plus small ROM regions, as S2EExecutionState registers them */
+template<typename Pool>
+void registerRegions(Pool &pool)
+{
+    pool.registerPool(RamStart, RamSize);
+    pool.registerPool(RamStart + RamSize, 1 << 17);
+    pool.registerPool(RamStart + RamSize + (1 << 20), 1 << 16);
+}
+
+/** Bytes of the flat array that the OS actually committed */
+uint64_t getResidentBytes(FlatMemoryCache &cache)
+{
+    uint64_t pageSize = sysconf(_SC_PAGESIZE);
+    uint64_t arraySize = (RamSize >> ObjectBits) * sizeof(Entry);
+    uint64_t pages = (arraySize + pageSize - 1) / pageSize;
+    std::vector<unsigned char> resident(pages);
+
+    if (mincore(cache.getArray(RamStart), arraySize, &resident[0]) < 0) {
+        perror("mincore");
+        return arraySize;
+    }
+
+    uint64_t bytes = 0;
+    for (uint64_t i = 0; i < pages; ++i) {
+        if (resident[i] & 1) {
+            bytes += pageSize;
+        }
+    }
+    return bytes;
+}
+
+/** Touches every stride-th guest page among the first pageCount ones */
+template<typename Cache>
+void populate(Cache &cache, uint64_t pageCount, unsigned stride)
+{
+    static Entry entry;
+    entry.first = &entry;
+    for (uint64_t page = 0; page < pageCount; page += stride) {
+        cache.put(RamStart + (page << PageBits), entry);
+    }
+}
+
+/** How clones used to be made: copy every resident page of the array */
+void copyResidentPages(uint8_t *dst, const uint8_t *src, uint64_t size)
+{
+    uint64_t pageSize = sysconf(_SC_PAGESIZE);
+    uint64_t pages = (size + pageSize - 1) / pageSize;
+    std::vector<unsigned char> resident(pages);
+
+    if (mincore((void*) src, size, &resident[0]) < 0) {
+        memcpy(dst, src, size);
+        return;
+    }
+
+    for (uint64_t i = 0; i < pages; ++i) {
+        if (resident[i] & 1) {
+            uint64_t offset = i * pageSize;
+            memcpy(dst + offset, src + offset, std::min(pageSize, size - offset));
+        }
+    }
+}
+
+void printMemory(const char *name, uint64_t bytes)
+{
+    printf("%-48s %10.2f MB per GB of guest RAM\n", name, (double) bytes / (1 << 20));
+}
+
+}
+
+int main()
+{
+    //Random addresses are precomputed so that the generator stays
+    //out of the measured loop
+    std::vector<uint64_t> addresses(1 << 20);
+    uint64_t seed = 88172645463325252ULL;
+    for (unsigned i = 0; i < addresses.size(); ++i) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        addresses[i] = RamStart + (seed & (RamSize - 1));
+    }
+    const uint64_t mask = addresses.size() - 1;
+
+    {
+        LegacyMemoryCache legacy(RamStart, RamSize);
+        FlatMemoryCache flat(RamStart, RamSize);
+
+        populate(legacy, PageCount / 10, 1);
+        populate(flat, PageCount / 10, 1);
+        printMemory("three-level, first 10% of pages touched", legacy.getMemoryUsage());
+        printMemory("flat, first 10% of pages touched", getResidentBytes(flat));
+
+        populate(legacy, PageCount, 10);
+        populate(flat, PageCount, 10);
+        printMemory("three-level, also every 10th page touched", legacy.getMemoryUsage());
+        printMemory("flat, also every 10th page touched", getResidentBytes(flat));
+
+        populate(legacy, PageCount, 1);
+        populate(flat, PageCount, 1);
+        printMemory("three-level, all pages touched", legacy.getMemoryUsage());
+        printMemory("flat, all pages touched", getResidentBytes(flat));
+
+        measure("three-level get (random)", Iterations, [&](uint64_t i) {
+            do_not_optimize((uintptr_t) legacy.get(addresses[i & mask]).first);
+        });
+
+        measure("flat get (random)", Iterations, [&](uint64_t i) {
+            do_not_optimize((uintptr_t) flat.get(addresses[i & mask]).first);
+        });
+
+        measure("three-level get (sequential)", Iterations, [&](uint64_t i) {
+            uint64_t address = RamStart + ((i << ObjectBits) & (RamSize - 1));
+            do_not_optimize((uintptr_t) legacy.get(address).first);
+        });
+
+        measure("flat get (sequential)", Iterations, [&](uint64_t i) {
+            uint64_t address = RamStart + ((i << ObjectBits) & (RamSize - 1));
+            do_not_optimize((uintptr_t) flat.get(address).first);
+        });
+    }
+
+    {
+        //Every 16th access goes to the last ROM region, which defeats
+        //the last-hit check of MemoryCachePool twice
+        std::vector<uint64_t> mixed(addresses);
+        for (unsigned i = 0; i < mixed.size(); i += 16) {
+            mixed[i] = RamStart + RamSize + (1 << 20) + (mixed[i] & 0xffff);
+        }
+
+        LinearMemoryCachePool linear;
+        FlatMemoryCachePool pool;
+        registerRegions(linear);
+        registerRegions(pool);
+        populate(linear, PageCount, 1);
+        populate(pool, PageCount, 1);
+
+        measure("linear scan pool get (random RAM)", Iterations, [&](uint64_t i) {
+            do_not_optimize((uintptr_t) linear.get(addresses[i & mask]).first);
+        });
+
+        measure("flat pool get (random RAM)", Iterations, [&](uint64_t i) {
+            do_not_optimize((uintptr_t) pool.get(addresses[i & mask]).first);
+        });
+
+        measure("linear scan pool get (1/16 ROM)", Iterations, [&](uint64_t i) {
+            do_not_optimize((uintptr_t) linear.get(mixed[i & mask]).first);
+        });
+
+        measure("flat pool get (1/16 ROM)", Iterations, [&](uint64_t i) {
+            do_not_optimize((uintptr_t) pool.get(mixed[i & mask]).first);
+        });
+    }
+
+    {
+        //A state that touched all of its RAM forks
+        FlatMemoryCachePool pool;
+        registerRegions(pool);
+        populate(pool, PageCount, 1);
+
+        uint64_t arraySize = (RamSize >> ObjectBits) * sizeof(Entry);
+        uint8_t *src = (uint8_t*) mmap(NULL, arraySize, PROT_READ | PROT_WRITE,
+                                       MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+        memset(src, 1, arraySize);
+
+        measure("copy resident pages of the array", 20, [&](uint64_t i) {
+            uint8_t *dst = (uint8_t*) mmap(NULL, arraySize, PROT_READ | PROT_WRITE,
+                                           MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+            copyResidentPages(dst, src, arraySize);
+            munmap(dst, arraySize);
+        });
+        munmap(src, arraySize);
+
+        measure("clone pool", 1000, [&](uint64_t i) {
+            FlatMemoryCachePool clone(pool);
+            do_not_optimize((uintptr_t) &clone);
+        });
+
+        //The clone copies a page of entries the first time it uses it
+        measure("clone pool, then get 1% of the pages", 100, [&](uint64_t i) {
+            FlatMemoryCachePool clone(pool);
+            for (uint64_t page = 0; page < PageCount; page += 100) {
+                do_not_optimize((uintptr_t) clone.get(RamStart + (page << PageBits)).first);
+            }
+        });
+    }
+
+    return 0;
+}
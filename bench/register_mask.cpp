@@ -0,0 +1,189 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+/**
+ * Models the symbolic register check done before every translation
+ * block is dispatched, with all-concrete and partially symbolic
+ * ARM register files. The uncached variant recomputes the mask with
+ * one isConcrete call per register, like getSymbolicRegistersMask did
+ * before. The cached variant is what a state in concrete mode pays now.
+ *
+ * The register ObjectState is a simplified stand-in for KLEE's.
+ */
+
+#include <string.h>
+
+#include "Bench.h"
+
+using namespace s2e::bench;
+
+namespace {
+
+const unsigned RegisterFileSize = 48 * 4;
+
+const uint64_t Iterations = 20000000;
+
+/* Keeps a concrete mask only once some byte became symbolic, like KLEE */
+class RegisterObject {
+private:
+    bool m_hasMask;
+    uint8_t m_concreteMask[RegisterFileSize / 8];
+
+    bool isByteConcrete(unsigned offset) const {
+        return !m_hasMask || (m_concreteMask[offset / 8] & (1 << (offset % 8)));
+    }
+
+public:
+    RegisterObject() : m_hasMask(false) {
+        memset(m_concreteMask, 0xff, sizeof(m_concreteMask));
+    }
+
+    void makeSymbolic(unsigned offset, unsigned size) {
+        m_hasMask = true;
+        for (unsigned i = offset; i < offset + size; ++i) {
+            m_concreteMask[i / 8] &= ~(1 << (i % 8));
+        }
+    }
+
+    bool isAllConcrete() const {
+        return isConcrete(0, RegisterFileSize * 8);
+    }
+
+    bool isConcrete(unsigned offset, unsigned width) const {
+        if (!m_hasMask) {
+            return true;
+        }
+        for (unsigned i = offset; i < offset + width / 8; ++i) {
+            if (!isByteConcrete(i)) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+/* Same checks as the TARGET_ARM branch of getSymbolicRegistersMask */
+uint64_t computeMask(const RegisterObject &os)
+{
+    if (os.isAllConcrete()) {
+        return 0;
+    }
+
+    uint64_t mask = 0;
+    for (unsigned i = 0; i < 4; ++i) { /* CF, VF, NF, ZF */
+        if (!os.isConcrete((29 + i) * 4, 4 * 8)) {
+            mask |= (1 << (i + 1));
+        }
+    }
+    for (unsigned i = 0; i < 15; ++i) { /* regs */
+        if (!os.isConcrete((33 + i) * 4, 4 * 8)) {
+            mask |= (1 << (i + 5));
+        }
+    }
+    for (unsigned i = 0; i < 29; ++i) { /* spsr, banked and shadow registers */
+        if (!os.isConcrete(i * 4, 4 * 8)) {
+            mask |= (1ULL << (i + 20));
+        }
+    }
+    return mask;
+}
+
+struct State {
+    RegisterObject registers;
+    uint64_t cachedMask;
+    bool cachedMaskValid;
+
+    State() : cachedMask(0), cachedMaskValid(false) {}
+
+    /* Same order as getSymbolicRegistersMask */
+    uint64_t getMaskCached() {
+        if (registers.isAllConcrete()) {
+            return 0;
+        }
+        if (cachedMaskValid) {
+            return cachedMask;
+        }
+        cachedMask = computeMask(registers);
+        cachedMaskValid = true;
+        return cachedMask;
+    }
+};
+
+uint64_t g_kleeBlocks;
+
+/* The dispatch decision of S2EExecutor::executeTranslationBlock */
+inline void dispatch(uint64_t smask, uint64_t tbReadMask)
+{
+    if (smask & tbReadMask) {
+        ++g_kleeBlocks;
+    } else {
+        do_not_optimize(smask);
+    }
+}
+
+void run(const char *kind, State &state)
+{
+    char name[64];
+
+    //Blocks that read r1..r3, which stay concrete in both setups
+    const uint64_t tbReadMask = 0x7 << 6;
+
+    snprintf(name, sizeof(name), "%s, recomputed", kind);
+    measure(name, Iterations, [&](uint64_t) {
+        dispatch(computeMask(state.registers), tbReadMask);
+    });
+
+    snprintf(name, sizeof(name), "%s, cached", kind);
+    measure(name, Iterations, [&](uint64_t) {
+        dispatch(state.getMaskCached(), tbReadMask);
+    });
+}
+
+}
+
+int main()
+{
+    State concrete;
+    run("all-concrete registers", concrete);
+
+    //r0 and ZF symbolic, as after a symbolic comparison
+    State partial;
+    partial.registers.makeSymbolic(33 * 4, 4);
+    partial.registers.makeSymbolic(32 * 4, 4);
+    run("partially symbolic registers", partial);
+
+    return g_kleeBlocks != 0;
+}
@@ -0,0 +1,108 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+/**
+ * Compares the cost of emitting a FastSignal against a sigc::signal
+ * with 0, 1 and 4 subscribers. This is the cost paid on every memory
+ * access and every instrumented instruction.
+ */
+
+#include <s2e/Signals.h>
+#include <sigc++/sigc++.h>
+
+#include "Bench.h"
+
+using namespace s2e;
+using namespace s2e::bench;
+
+namespace {
+
+uint64_t g_counter;
+
+struct Subscriber : public sigc::trackable {
+    void onEvent(uint64_t value) {
+        g_counter += value;
+    }
+
+    static void onEventRaw(void *context, uint64_t value) {
+        static_cast<Subscriber*>(context)->onEvent(value);
+    }
+};
+
+const uint64_t Iterations = 50000000;
+
+void run(unsigned subscriberCount)
+{
+    Subscriber subscribers[4];
+    char name[64];
+
+    sigc::signal<void, uint64_t> sigcSignal;
+    FastSignal<uint64_t> fastSlotSignal;
+    FastSignal<uint64_t> fastRawSignal;
+
+    for (unsigned i = 0; i < subscriberCount; ++i) {
+        sigcSignal.connect(sigc::mem_fun(subscribers[i], &Subscriber::onEvent));
+        fastSlotSignal.connect(sigc::mem_fun(subscribers[i], &Subscriber::onEvent));
+        fastRawSignal.connect(&Subscriber::onEventRaw, &subscribers[i]);
+    }
+
+    snprintf(name, sizeof(name), "sigc::signal, %u subscribers", subscriberCount);
+    measure(name, Iterations, [&](uint64_t i) { sigcSignal.emit(i); });
+
+    snprintf(name, sizeof(name), "FastSignal (sigc slots), %u subscribers", subscriberCount);
+    measure(name, Iterations, [&](uint64_t i) { fastSlotSignal.emit(i); });
+
+    snprintf(name, sizeof(name), "FastSignal (raw callbacks), %u subscribers", subscriberCount);
+    measure(name, Iterations, [&](uint64_t i) { fastRawSignal.emit(i); });
+
+    //Hot paths check empty() before marshalling the arguments
+    snprintf(name, sizeof(name), "sigc::signal empty(), %u subscribers", subscriberCount);
+    measure(name, Iterations, [&](uint64_t i) { do_not_optimize(sigcSignal.empty()); });
+
+    snprintf(name, sizeof(name), "FastSignal empty(), %u subscribers", subscriberCount);
+    measure(name, Iterations, [&](uint64_t i) { do_not_optimize(fastRawSignal.empty()); });
+}
+
+}
+
+int main()
+{
+    run(0);
+    run(1);
+    run(4);
+    do_not_optimize(g_counter);
+    return 0;
+}
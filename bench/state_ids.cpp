@@ -0,0 +1,130 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+/**
+ * Measures how fast concurrent S2E instances can allocate state ids
+ * from the shared S2EShared counter. The semaphore variant is what
+ * fork-heavy runs used to pay, the atomic variant is the current
+ * S2E::fetchAndIncrementStateId().
+ */
+
+#include <s2e/Synchronization.h>
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "Bench.h"
+
+using namespace s2e;
+using namespace s2e::bench;
+
+namespace {
+
+struct SharedCounter {
+    unsigned lastStateId;
+
+    SharedCounter() : lastStateId(0) {}
+};
+
+const unsigned IdsPerProcess = 2000000;
+
+unsigned allocateLocked(S2ESynchronizedObject<SharedCounter> &sync)
+{
+    SharedCounter *shared = sync.acquire();
+    unsigned id = shared->lastStateId++;
+    sync.release();
+    return id;
+}
+
+unsigned allocateAtomic(S2ESynchronizedObject<SharedCounter> &sync)
+{
+    return AtomicFunctions::fetchAndAdd(&sync.get()->lastStateId, 1);
+}
+
+/** Forks processCount children that each allocate IdsPerProcess ids */
+void run(const char *variant, unsigned processCount, bool atomic)
+{
+    S2ESynchronizedObject<SharedCounter> sync;
+
+    uint64_t start = now_ns();
+    for (unsigned i = 0; i < processCount; ++i) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            exit(-1);
+        }
+
+        if (pid == 0) {
+            uint64_t sum = 0;
+            for (unsigned j = 0; j < IdsPerProcess; ++j) {
+                sum += atomic ? allocateAtomic(sync) : allocateLocked(sync);
+            }
+            do_not_optimize(sum);
+            _exit(0);
+        }
+    }
+
+    for (unsigned i = 0; i < processCount; ++i) {
+        int status;
+        wait(&status);
+    }
+    uint64_t end = now_ns();
+
+    unsigned expected = processCount * IdsPerProcess;
+    if (AtomicFunctions::read(&sync.get()->lastStateId) != expected) {
+        fprintf(stderr, "%s: lost state ids\n", variant);
+        exit(-1);
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s, %u processes", variant, processCount);
+    printf("%-48s %10.2f ns/op\n", name, (double) (end - start) / expected);
+}
+
+}
+
+int main()
+{
+    static const unsigned processCounts[] = {1, 2, 4, 8};
+
+    for (unsigned i = 0; i < sizeof(processCounts) / sizeof(processCounts[0]); ++i) {
+        run("semaphore", processCounts[i], false);
+        run("fetchAndAdd", processCounts[i], true);
+    }
+
+    return 0;
+}
@@ -0,0 +1,144 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+#ifndef S2E_DIRTY_PAGE_TRACKER_H
+#define S2E_DIRTY_PAGE_TRACKER_H
+
+#include <inttypes.h>
+#include <vector>
+
+#ifndef _WIN32
+#include <signal.h>
+#endif
+
+namespace s2e {
+
+/**
+ * Tracks which host pages of the registered regions were written since
+ * the last call to reset(). Clean pages are write-protected; the first
+ * write to such a page faults, gets recorded, and the page is made
+ * writable again. This lets the executor save and restore only the
+ * part of the guest RAM that actually changed on a state switch.
+ *
+ * There is at most one active tracker per process, because it owns
+ * the SIGSEGV handler. Writes done by the kernel on behalf of QEMU
+ * (e.g., read() or O_DIRECT disk reads into guest RAM) do not fault
+ * and fail with EFAULT instead, which is why tracking is opt-in and
+ * must not be combined with direct I/O into guest memory.
+ * On Windows, tracking is not implemented and all pages are dirty.
+ */
+class DirtyPageTracker
+{
+private:
+    struct Region {
+        uintptr_t start;
+        uintptr_t size;
+        uint8_t *dirty;
+    };
+
+    std::vector<Region> m_regions;
+
+    /* Preallocated, so that the signal handler never allocates */
+    std::vector<uintptr_t> m_dirtyList;
+    volatile uint64_t m_dirtyCount;
+
+    uintptr_t m_pageSize;
+    bool m_handlerInstalled;
+
+    /* Serializes the fault handler with collectDirtyPages */
+    volatile int m_lock;
+
+    void lock() {
+        while (__sync_lock_test_and_set(&m_lock, 1)) {
+        }
+    }
+
+    void unlock() {
+        __sync_lock_release(&m_lock);
+    }
+
+    static DirtyPageTracker *s_instance;
+
+    void installHandler();
+    bool markDirty(uintptr_t address);
+
+#ifndef _WIN32
+    struct sigaction m_oldAction;
+    static void segvHandler(int sig, siginfo_t *info, void *context);
+#endif
+
+public:
+    DirtyPageTracker();
+    ~DirtyPageTracker();
+
+    /**
+     * Starts tracking the given host memory. All pages of the region
+     * are initially considered dirty, as nothing is known about them.
+     */
+    void addRegion(uintptr_t start, uintptr_t size);
+
+    bool isTracked(uintptr_t address) const;
+
+    /**
+     * Appends the pages written since the previous call to pages,
+     * write-protects them and marks them clean. Writes that happen
+     * after the pages are protected fault and are reported by the
+     * next call, so the caller may copy the returned pages while
+     * other threads keep running.
+     */
+    void collectDirtyPages(std::vector<uintptr_t> &pages);
+
+    /**
+     * Makes all regions writable without marking any page dirty, so
+     * that the contents of another state can be restored with plain
+     * copies. No other thread may write to the tracked memory until
+     * protectAll() is called.
+     */
+    void unprotectAll();
+    void protectAll();
+
+    uint64_t getDirtyPageCount() const {
+        return m_dirtyCount;
+    }
+
+    uintptr_t getPageSize() const {
+        return m_pageSize;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,183 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+#ifndef S2E_MEMORY_ACCESS_BUFFER_H
+#define S2E_MEMORY_ACCESS_BUFFER_H
+
+#include <klee/Expr.h>
+#include <vector>
+#include <algorithm>
+#include <inttypes.h>
+#include <assert.h>
+
+namespace s2e {
+
+enum MemoryAccessFlags {
+    MEM_TRACE_WRITE = 1,
+    MEM_TRACE_IO = 2,
+    MEM_TRACE_CODE = 4,
+    /* Some of the operands are symbolic, see MemoryAccessBuffer::getSymbolicAccess */
+    MEM_TRACE_SYMBOLIC = 8
+};
+
+/** A memory access as seen by CorePlugin::onDataMemoryAccessBatch */
+struct MemoryAccessRecord
+{
+    uint64_t virtualAddress;
+    uint64_t hostAddress;
+    /* The accessed value, or an index into the symbolic accesses
+       when MEM_TRACE_SYMBOLIC is set */
+    uint64_t value;
+    uint32_t size;
+    uint32_t flags;
+
+    bool isWrite() const { return flags & MEM_TRACE_WRITE; }
+    bool isIO() const { return flags & MEM_TRACE_IO; }
+    bool isCode() const { return flags & MEM_TRACE_CODE; }
+    bool isSymbolic() const { return flags & MEM_TRACE_SYMBOLIC; }
+};
+
+struct SymbolicMemoryAccess
+{
+    klee::ref<klee::Expr> virtualAddress;
+    klee::ref<klee::Expr> hostAddress;
+    klee::ref<klee::Expr> value;
+};
+
+/**
+ * Per-state buffer of memory accesses that are waiting to be delivered
+ * to onDataMemoryAccessBatch subscribers. Concrete accesses are stored as
+ * raw records, expressions are only kept for symbolic ones.
+ *
+ * The buffer is drained entirely on each delivery: at the end of each
+ * translation block, when it fills up, before the state forks, and before
+ * the state is switched out or killed.
+ */
+class MemoryAccessBuffer
+{
+public:
+    static const unsigned CAPACITY = 4096;
+
+private:
+    /* Allocated on first use, most states never trace memory */
+    MemoryAccessRecord *m_records;
+    unsigned m_count;
+    std::vector<SymbolicMemoryAccess> m_symbolic;
+
+    MemoryAccessBuffer& operator=(const MemoryAccessBuffer&);
+
+    MemoryAccessRecord &push(uint64_t hostAddress, unsigned size, unsigned flags) {
+        assert(m_count < CAPACITY);
+        if (!m_records) {
+            m_records = new MemoryAccessRecord[CAPACITY];
+        }
+        MemoryAccessRecord &r = m_records[m_count++];
+        r.hostAddress = hostAddress;
+        r.size = size;
+        r.flags = flags;
+        return r;
+    }
+
+public:
+    MemoryAccessBuffer(): m_records(NULL), m_count(0) {}
+
+    /* Pending accesses belong to the state that performed them,
+       the buffer is flushed before forking anyway. */
+    MemoryAccessBuffer(const MemoryAccessBuffer&): m_records(NULL), m_count(0) {}
+
+    ~MemoryAccessBuffer() {
+        delete [] m_records;
+    }
+
+    bool empty() const { return m_count == 0; }
+    bool full() const { return m_count == CAPACITY; }
+    unsigned size() const { return m_count; }
+
+    const MemoryAccessRecord &operator[](unsigned i) const {
+        assert(i < m_count);
+        return m_records[i];
+    }
+
+    void append(uint64_t virtualAddress, uint64_t hostAddress,
+                uint64_t value, unsigned size, unsigned flags) {
+        MemoryAccessRecord &r = push(hostAddress, size, flags);
+        r.virtualAddress = virtualAddress;
+        r.value = value;
+    }
+
+    void appendSymbolic(const klee::ref<klee::Expr> &virtualAddress,
+                        const klee::ref<klee::Expr> &hostAddress,
+                        const klee::ref<klee::Expr> &value,
+                        unsigned size, unsigned flags) {
+        uint64_t haddr = 0;
+        if (klee::ConstantExpr *ce = llvm::dyn_cast<klee::ConstantExpr>(hostAddress)) {
+            haddr = ce->getZExtValue();
+        }
+
+        MemoryAccessRecord &r = push(haddr, size, flags | MEM_TRACE_SYMBOLIC);
+        r.virtualAddress = 0;
+        if (klee::ConstantExpr *ce = llvm::dyn_cast<klee::ConstantExpr>(virtualAddress)) {
+            r.virtualAddress = ce->getZExtValue();
+        }
+        r.value = m_symbolic.size();
+
+        SymbolicMemoryAccess access;
+        access.virtualAddress = virtualAddress;
+        access.hostAddress = hostAddress;
+        access.value = value;
+        m_symbolic.push_back(access);
+    }
+
+    const SymbolicMemoryAccess &getSymbolicAccess(const MemoryAccessRecord &r) const {
+        assert(r.isSymbolic() && r.value < m_symbolic.size());
+        return m_symbolic[r.value];
+    }
+
+    void clear() {
+        m_count = 0;
+        m_symbolic.clear();
+    }
+
+    void swap(MemoryAccessBuffer &other) {
+        std::swap(m_records, other.m_records);
+        std::swap(m_count, other.m_count);
+        m_symbolic.swap(other.m_symbolic);
+    }
+};
+
+}
+
+#endif // S2E_MEMORY_ACCESS_BUFFER_H
@@ -3,62 +3,201 @@
 #define _S2E_MEMORY_CACHE_
 
 #include <vector>
+#include <memory>
+#include <algorithm>
 #include <inttypes.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 #include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/DenseMap.h>
 #include <iostream>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
 namespace s2e {
 
-template <class T, unsigned OBJSIZE_BITS, unsigned PAGESIZE_BITS, unsigned SUPERPAGESIZE_BITS>
-class MemoryCache
+/**
+ * Flat array of cache entries. It is only reserved up front and its
+ * pages are committed when entries are first written, so that untouched
+ * parts of the guest RAM cost no memory. On POSIX systems the OS does
+ * this on the first page fault, Windows needs an explicit commit.
+ * m_valid marks the pages that hold entries.
+ */
+template <class T>
+class MemoryCacheArray
 {
 private:
-    struct ThirdLevel {
-        T level3[1<<(PAGESIZE_BITS-OBJSIZE_BITS)];
-        ThirdLevel() {
-            for (unsigned i=0; i<(1<<(PAGESIZE_BITS-OBJSIZE_BITS)); ++i) {
-                level3[i] = T();
-            }
-        }
-    };
+    static const unsigned ARRAY_PAGE_BITS = 12;
+
+    T *m_objects;
+    uint64_t m_size;
+    std::vector<bool> m_valid;
+    uint64_t m_validPages;
 
-    struct SecondLevel {
-        ThirdLevel* level2[1<<(SUPERPAGESIZE_BITS-PAGESIZE_BITS)];
+    MemoryCacheArray(const MemoryCacheArray &);
+    void operator=(const MemoryCacheArray &);
 
-        SecondLevel() {
-            for (unsigned i=0; i<(1<<(SUPERPAGESIZE_BITS-PAGESIZE_BITS)); ++i) {
-                level2[i] = NULL;
-            }
+public:
+    MemoryCacheArray(uint64_t count) : m_validPages(0)
+    {
+        uint64_t pageSize = 1 << ARRAY_PAGE_BITS;
+        m_size = (count * sizeof(T) + pageSize - 1) & ~(pageSize - 1);
+        m_valid.assign(m_size >> ARRAY_PAGE_BITS, false);
+
+#ifdef _WIN32
+        m_objects = (T*) VirtualAlloc(NULL, m_size, MEM_RESERVE, PAGE_READWRITE);
+        if (!m_objects) {
+#else
+        m_objects = (T*) mmap(NULL, m_size, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+        if (m_objects == MAP_FAILED) {
+#endif
+            std::cerr << "Could not reserve memory cache of size " << m_size << std::endl;
+            exit(-1);
         }
+    }
 
-        ~SecondLevel() {
-            for (unsigned i=0; i<(1<<(SUPERPAGESIZE_BITS-PAGESIZE_BITS)); ++i) {
-                if (level2[i]) {
-                    delete level2[i];
-                    level2[i] = NULL;
-                }
-            }
+    ~MemoryCacheArray() {
+#ifdef _WIN32
+        VirtualFree(m_objects, 0, MEM_RELEASE);
+#else
+        munmap(m_objects, m_size);
+#endif
+    }
+
+    inline T *getObjects() const {
+        return m_objects;
+    }
+
+    inline uint64_t getPage(uint64_t index) const {
+        return (index * sizeof(T)) >> ARRAY_PAGE_BITS;
+    }
+
+    inline bool isValid(uint64_t page) const {
+        return m_valid[page];
+    }
+
+    inline uint64_t getValidPages() const {
+        return m_validPages;
+    }
+
+    /** Makes a page writable, its entries are empty */
+    inline void commit(uint64_t page)
+    {
+        assert(!m_valid[page]);
+#ifdef _WIN32
+        uint8_t *address = (uint8_t*) m_objects + (page << ARRAY_PAGE_BITS);
+        if (!VirtualAlloc(address, 1 << ARRAY_PAGE_BITS, MEM_COMMIT, PAGE_READWRITE)) {
+            std::cerr << "Could not commit memory cache page" << std::endl;
+            exit(-1);
         }
-    };
+#endif
+        m_valid[page] = true;
+        ++m_validPages;
+    }
 
-    SecondLevel **m_level1;
+    /** Commits a page and fills it with the same page of another array */
+    inline void copyPage(uint64_t page, const MemoryCacheArray &from)
+    {
+        assert(from.m_valid[page]);
+        commit(page);
+        uint64_t offset = page << ARRAY_PAGE_BITS;
+        memcpy((uint8_t*) m_objects + offset, (const uint8_t*) from.m_objects + offset,
+               1 << ARRAY_PAGE_BITS);
+    }
+
+    /** Gives all pages back to the OS, they read as zero afterwards */
+    inline void clear()
+    {
+#ifdef _WIN32
+        VirtualFree(m_objects, m_size, MEM_DECOMMIT);
+#else
+        madvise(m_objects, m_size, MADV_DONTNEED);
+#endif
+        m_valid.assign(m_valid.size(), false);
+        m_validPages = 0;
+    }
+};
+
+/**
+ * Caches one T per object of a host memory region, in a MemoryCacheArray.
+ *
+ * A clone shares the entries of its source instead of copying them.
+ * The source's array becomes a read-only base of both caches, and each
+ * of them starts a new, empty array. A page of the base is copied into
+ * the array of a cache the first time that cache reads or writes it, so
+ * a clone costs nothing up front and then one page copy per page that
+ * is used again.
+ * Only one base is kept. When a cache is cloned again, the pages it did
+ * not use since the previous clone are dropped and later miss.
+ *
+ * T must be valid when all its bytes are zero, which is what a freshly
+ * committed page contains, and compare equal to T() in that case.
+ */
+template <class T, unsigned OBJSIZE_BITS, unsigned PAGESIZE_BITS, unsigned SUPERPAGESIZE_BITS>
+class MemoryCache
+{
+private:
+    typedef MemoryCacheArray<T> ArrayT;
+
+    ArrayT *m_array;
+    T *m_objects;
+    std::shared_ptr<const ArrayT> m_base;
     uint64_t m_hostAddrStart;
     uint64_t m_size;
-    unsigned m_pagecount;
+    uint64_t m_count;
+
+    void operator=(const MemoryCache &);
 
-    inline void resize()
+    inline void allocate()
     {
-        uint64_t mask = (1<<SUPERPAGESIZE_BITS)-1;
-        uint64_t pagecount = m_size >> SUPERPAGESIZE_BITS;
-        if (m_size & mask) {
-            ++pagecount;
+        m_count = m_size >> OBJSIZE_BITS;
+        if (m_size & ((1<<OBJSIZE_BITS)-1)) {
+            ++m_count;
         }
+        m_array = new ArrayT(m_count);
+        m_objects = m_array->getObjects();
+    }
+
+    /** Makes the entries written so far the read-only base */
+    inline void freeze()
+    {
+        if (m_array->getValidPages() == 0) {
+            //Everything is still in the current base, if any
+            return;
+        }
+        m_base.reset(m_array);
+        m_array = new ArrayT(m_count);
+        m_objects = m_array->getObjects();
+    }
+
+    /** Makes a page of the array valid, copying it from the base if possible */
+    inline void validate(uint64_t page)
+    {
+        if (m_base && m_base->isValid(page)) {
+            m_array->copyPage(page, *m_base);
+        } else {
+            m_array->commit(page);
+        }
+    }
 
-        m_pagecount = pagecount;
-        m_level1 = new SecondLevel*[pagecount];
-        for (unsigned i=0; i< pagecount; ++i) {
-            m_level1[i] = NULL;
+    /** Reads an entry that may still be in the base */
+    T getFromBase(uint64_t index)
+    {
+        uint64_t page = m_array->getPage(index);
+        if (!m_array->isValid(page)) {
+            if (!m_base || !m_base->isValid(page)) {
+                return T();
+            }
+            m_array->copyPage(page, *m_base);
         }
+        return m_objects[index];
     }
 
 public:
@@ -66,18 +205,25 @@ public:
     {
         m_hostAddrStart = hostAddrStart;
         m_size = size;
-        resize();
+        allocate();
     }
 
-    //XXX: Clone an empty cache for now
-    MemoryCache(const MemoryCache &one) {
+    /**
+     * The clone starts warm. The cached ObjectStates are shared with the
+     * parent right after a fork, and addressSpaceChange() updates them
+     * when either state makes its own copy.
+     * one keeps the same entries, but now reads them from the shared base.
+     */
+    MemoryCache(MemoryCache &one) {
         m_hostAddrStart = one.m_hostAddrStart;
         m_size = one.m_size;
-        resize();
+        one.freeze();
+        allocate();
+        m_base = one.m_base;
     }
 
     ~MemoryCache() {
-        flushCache();
+        delete m_array;
     }
 
     inline uint64_t getSize() const {
@@ -89,12 +235,8 @@ public:
     }
 
     inline void flushCache() {
-        for (unsigned i=0; i<m_pagecount; ++i) {
-            if (m_level1[i]) {
-                delete m_level1[i];
-                m_level1[i] = NULL;
-            }
-        }
+        m_base.reset();
+        m_array->clear();
     }
 
     inline bool contains(uint64_t hostAddress) {
@@ -103,65 +245,43 @@ public:
 
     inline void put(uint64_t hostAddress, const T &obj)
     {
-        uint64_t offset = hostAddress - m_hostAddrStart;
-        uint64_t level1 = offset >> SUPERPAGESIZE_BITS;
-        uint64_t level2 = (offset & ((1<<SUPERPAGESIZE_BITS)-1)) >> PAGESIZE_BITS;
-        uint64_t level3 = (offset >> OBJSIZE_BITS) & ((1<<(PAGESIZE_BITS-OBJSIZE_BITS))-1);
-
-        SecondLevel *ptrLevel2;
-        if (!(ptrLevel2 = m_level1[level1])) {
-            ptrLevel2 = new SecondLevel();
-            m_level1[level1] = ptrLevel2;
+        uint64_t index = (hostAddress - m_hostAddrStart) >> OBJSIZE_BITS;
+        assert(index < m_count);
+        uint64_t page = m_array->getPage(index);
+        if (!m_array->isValid(page)) {
+            validate(page);
         }
-
-        ThirdLevel *ptrLevel3;
-        if (!(ptrLevel3 = ptrLevel2->level2[level2])) {
-            ptrLevel3 = new ThirdLevel();
-            ptrLevel2->level2[level2] = ptrLevel3;
-        }
-
-        assert(level3 < (1<<(PAGESIZE_BITS-OBJSIZE_BITS)));
-
-        ptrLevel3->level3[level3] = obj;
+        m_objects[index] = obj;
     }
 
     inline T get(uint64_t hostAddress)
     {
-        uint64_t offset = hostAddress - m_hostAddrStart;
-        uint64_t level1 = offset >> SUPERPAGESIZE_BITS;
-        uint64_t level2 = (offset & ((1<<SUPERPAGESIZE_BITS)-1)) >> PAGESIZE_BITS;
-        uint64_t level3 = (offset >> OBJSIZE_BITS) & ((1<<(PAGESIZE_BITS-OBJSIZE_BITS))-1);
-
-        SecondLevel *ptrLevel2;
-        if (!(ptrLevel2 = m_level1[level1])) {
-            return T();
+        uint64_t index = (hostAddress - m_hostAddrStart) >> OBJSIZE_BITS;
+        assert(index < m_count);
+#ifndef _WIN32
+        //Pages that were never written read as zero, so hits and
+        //caches without a base need no look at the valid pages
+        if (!m_base || !(m_objects[index] == T())) {
+            return m_objects[index];
         }
-
-        ThirdLevel *ptrLevel3;
-        if (!(ptrLevel3 = ptrLevel2->level2[level2])) {
-            return T();
-        }
-
-        return ptrLevel3->level3[level3];
+#endif
+        return getFromBase(index);
     }
 
+    /** Returns the entries of the page that contains hostAddress */
     inline T* getArray(uint64_t hostAddress)
     {
-        uint64_t offset = hostAddress - m_hostAddrStart;
-        uint64_t level1 = offset >> SUPERPAGESIZE_BITS;
-        uint64_t level2 = (offset & ((1<<SUPERPAGESIZE_BITS)-1)) >> PAGESIZE_BITS;
-
-        SecondLevel *ptrLevel2;
-        if (!(ptrLevel2 = m_level1[level1])) {
-            return NULL;
-        }
-
-        ThirdLevel *ptrLevel3;
-        if (!(ptrLevel3 = ptrLevel2->level2[level2])) {
-            return NULL;
+        uint64_t offset = (hostAddress - m_hostAddrStart) & ~(uint64_t)((1<<PAGESIZE_BITS)-1);
+        uint64_t first = offset >> OBJSIZE_BITS;
+        uint64_t last = first + (1 << (PAGESIZE_BITS - OBJSIZE_BITS)) - 1;
+        assert(first < m_count);
+        last = std::min(last, m_count - 1);
+        for (uint64_t page = m_array->getPage(first); page <= m_array->getPage(last); ++page) {
+            if (!m_array->isValid(page)) {
+                validate(page);
+            }
         }
-
-        return ptrLevel3->level3;
+        return &m_objects[first];
     }
 };
 
@@ -173,16 +293,76 @@ private:
     typedef llvm::SmallVector<MemoryCacheT*, 10> Caches;
     Caches m_caches;
 
+    //Maps a superpage number to the only cache that overlaps it.
+    //Superpages shared by several regions map to NULL and are
+    //resolved by scanning the list of caches.
+    typedef llvm::DenseMap<uint64_t, MemoryCacheT*> SuperPageMap;
+    SuperPageMap m_superPages;
+
+    //Most accesses hit the RAM region, checking the last region
+    //that matched avoids hashing the superpage number
+    MemoryCacheT *m_lastHit;
+
+    void mapRegion(MemoryCacheT *mc)
+    {
+        uint64_t first = mc->getStart() >> SUPERPAGESIZE_BITS;
+        uint64_t last = (mc->getStart() + mc->getSize() - 1) >> SUPERPAGESIZE_BITS;
+        for (uint64_t sp = first; sp <= last; ++sp) {
+            typename SuperPageMap::iterator it = m_superPages.find(sp);
+            if (it == m_superPages.end()) {
+                m_superPages[sp] = mc;
+            } else {
+                it->second = NULL;
+            }
+        }
+    }
+
+    inline MemoryCacheT *lookup(uint64_t hostAddress)
+    {
+        if (m_lastHit && m_lastHit->contains(hostAddress)) {
+            return m_lastHit;
+        }
+
+        MemoryCacheT *mc = lookupSlow(hostAddress);
+        if (mc) {
+            m_lastHit = mc;
+        }
+        return mc;
+    }
+
+    MemoryCacheT *lookupSlow(uint64_t hostAddress)
+    {
+        typename SuperPageMap::const_iterator it = m_superPages.find(hostAddress >> SUPERPAGESIZE_BITS);
+        if (it == m_superPages.end()) {
+            return NULL;
+        }
+
+        MemoryCacheT *mc = it->second;
+        if (mc) {
+            return mc->contains(hostAddress) ? mc : NULL;
+        }
+
+        for ( auto cache_entry : m_caches ) {
+            if (cache_entry->contains(hostAddress)) {
+                return cache_entry;
+            }
+        }
+        return NULL;
+    }
+
 public:
-    MemoryCachePool() {
+    MemoryCachePool() : m_lastHit(NULL) {
 
     }
 
-    MemoryCachePool(const MemoryCachePool &one) {
+    //The caches of one are not modified, but they start sharing
+    //their entries with the clone, see MemoryCache(MemoryCache&)
+    MemoryCachePool(const MemoryCachePool &one) : m_lastHit(NULL) {
         for (unsigned i=0; i<one.m_caches.size(); ++i) {
-            m_caches.push_back(new MemoryCacheT(*one.m_caches[i]));
+            MemoryCacheT *mc = new MemoryCacheT(*one.m_caches[i]);
+            m_caches.push_back(mc);
+            mapRegion(mc);
         }
-
     }
 
     ~MemoryCachePool() {
@@ -202,11 +382,13 @@ public:
 
     //We sort the cache be decreasing size.
     //The idea is that most accesses fall in the RAM, so it will
-    //be found first in the list.
+    //be found first in the list when a superpage is shared.
     void registerPool(uint64_t hostAddrStart, uint64_t size)
     {
         assert((hostAddrStart & ((1<<PAGESIZE_BITS)-1)) == 0);
         MemoryCacheT *mc = new MemoryCacheT(hostAddrStart, size);
+        mapRegion(mc);
+
         if (m_caches.size() == 0) {
             m_caches.push_back(mc);
             return;
@@ -225,31 +407,21 @@ public:
 
     void put(uint64_t hostAddress, const T &obj)
     {
-	for ( auto cache_entry : m_caches ) {
-            if (cache_entry->contains(hostAddress)) {
-                cache_entry->put(hostAddress, obj);
-                return;
-            }
+        MemoryCacheT *mc = lookup(hostAddress);
+        if (mc) {
+            mc->put(hostAddress, obj);
         }
     }
 
     T* getArray(uint64_t hostAddress) {
-	for ( auto cache_entry : m_caches ) {
-            if (cache_entry->contains(hostAddress)) {
-                return cache_entry->getArray(hostAddress);
-            }
-        }
-        return NULL;
+        MemoryCacheT *mc = lookup(hostAddress);
+        return mc ? mc->getArray(hostAddress) : NULL;
     }
 
     T get(uint64_t hostAddress)
     {
-	for ( auto cache_entry : m_caches ) {
-            if (cache_entry->contains(hostAddress)) {
-                return cache_entry->get(hostAddress);
-            }
-        }
-        return T();
+        MemoryCacheT *mc = lookup(hostAddress);
+        return mc ? mc->get(hostAddress) : T();
     }
 
 };
@@ -52,13 +52,13 @@ class S2EExecutionState;
 class Plugin : public sigc::trackable{
 private:
     S2E* m_s2e;
-protected:
-    mutable PluginState *m_CachedPluginState;
-    mutable S2EExecutionState *m_CachedPluginS2EState;
+
+    /* Position of the plugin among the active plugins,
+       used to index per-state plugin data */
+    unsigned m_index;
 
 public:
-    Plugin(S2E* s2e) : m_s2e(s2e),m_CachedPluginState(NULL),
-        m_CachedPluginS2EState(NULL) {}
+    Plugin(S2E* s2e) : m_s2e(s2e), m_index(0) {}
 
     virtual ~Plugin() {}
 
@@ -78,10 +78,12 @@ public:
 
     PluginState *getPluginState(S2EExecutionState *s, PluginState* (*f)(Plugin *, S2EExecutionState *)) const;
 
-    void refresh() {
-        m_CachedPluginS2EState = NULL;
-        m_CachedPluginState = NULL;
-    }
+    /** Same as getPluginState, but never copies a shared copy-on-write state */
+    const PluginState *getPluginStateConst(S2EExecutionState *s,
+                                           PluginState* (*f)(Plugin *, S2EExecutionState *)) const;
+
+    unsigned getIndex() const { return m_index; }
+    void setIndex(unsigned index) { m_index = index; }
 };
 
 #define DECLARE_PLUGINSTATE_P(plg, c, execstate) \
@@ -94,16 +96,36 @@ public:
     c *name = static_cast<c*>(getPluginState(execstate, &c::factory))
 
 #define DECLARE_PLUGINSTATE_CONST(c, execstate) \
-    const c *plgState = static_cast<c*>(getPluginState(execstate, &c::factory))
+    const c *plgState = static_cast<const c*>(getPluginStateConst(execstate, &c::factory))
 
 #define DECLARE_PLUGINSTATE_NCONST(c, name, execstate) \
-    const c *name = static_cast<c*>(getPluginState(execstate, &c::factory))
+    const c *name = static_cast<const c*>(getPluginStateConst(execstate, &c::factory))
 
 class PluginState
 {
+private:
+    /* Number of execution states that refer to this object */
+    unsigned m_refCount;
+
+    friend class S2EExecutionState;
+
 public:
+    PluginState() : m_refCount(1) {}
+
+    /* Copies made by clone() are not shared yet */
+    PluginState(const PluginState &) : m_refCount(1) {}
+    PluginState &operator=(const PluginState &) { return *this; }
+
     virtual ~PluginState() {};
     virtual PluginState *clone() const = 0;
+
+    /**
+     * Return true to let forked states share this object. It is cloned
+     * on the first mutable access (DECLARE_PLUGINSTATE) from a state that
+     * shares it; DECLARE_PLUGINSTATE_CONST never clones it.
+     * The object must not depend on the state that created it.
+     */
+    virtual bool isCopyOnWrite() const { return false; }
 };
 
 
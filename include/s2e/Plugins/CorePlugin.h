@@ -37,6 +37,9 @@
 #define S2E_CORE_PLUGIN_H
 
 #include <s2e/Plugin.h>
+#include <s2e/Signals.h>
+#include <s2e/MemoryAccessBuffer.h>
+#include <s2e/s2e_config.h>
 #include <klee/Expr.h>
 
 #include <sigc++/sigc++.h>
@@ -59,9 +62,40 @@ namespace s2e {
 
 class S2EExecutionState;
 
-/** A type of a signal emitted on instruction execution. Instances of this signal
-    will be dynamically created and destroyed on demand during translation. */
-typedef sigc::signal<void, S2EExecutionState*, uint64_t /* pc */> ExecutionSignal;
+/** Signals emitted on every memory and port access */
+#ifdef S2E_USE_FAST_SIGNALS
+typedef FastSignal<S2EExecutionState*,
+                   klee::ref<klee::Expr> /* virtualAddress */,
+                   klee::ref<klee::Expr> /* hostAddress */,
+                   klee::ref<klee::Expr> /* value */,
+                   bool /* isWrite */, bool /* isIO */, bool /* isCode */>
+        DataMemoryAccessSignal;
+
+typedef FastSignal<S2EExecutionState*,
+                   klee::ref<klee::Expr> /* port */,
+                   klee::ref<klee::Expr> /* value */,
+                   bool /* isWrite */>
+        PortAccessSignal;
+
+typedef FastSignal<S2EExecutionState*, const MemoryAccessBuffer&>
+        MemoryAccessBatchSignal;
+#else
+typedef sigc::signal<void, S2EExecutionState*,
+                     klee::ref<klee::Expr> /* virtualAddress */,
+                     klee::ref<klee::Expr> /* hostAddress */,
+                     klee::ref<klee::Expr> /* value */,
+                     bool /* isWrite */, bool /* isIO */, bool /* isCode */>
+        DataMemoryAccessSignal;
+
+typedef sigc::signal<void, S2EExecutionState*,
+                     klee::ref<klee::Expr> /* port */,
+                     klee::ref<klee::Expr> /* value */,
+                     bool /* isWrite */>
+        PortAccessSignal;
+
+typedef sigc::signal<void, S2EExecutionState*, const MemoryAccessBuffer&>
+        MemoryAccessBatchSignal;
+#endif
 
 /** This is a callback to check whether some port returns symbolic values.
   * An interested plugin can use it. Only one plugin can use it at a time.
@@ -79,6 +113,9 @@ private:
     void *m_isPortSymbolicOpaque;
     void *m_isMmioSymbolicOpaque;
 
+    /* The batch being delivered, detached from the state's buffer */
+    MemoryAccessBuffer m_memoryAccessBatch;
+
 public:
     CorePlugin(S2E* s2e): Plugin(s2e) {
         m_Timer = NULL;
@@ -123,6 +160,9 @@ public:
         return m_Timer;
     }
 
+    /** Delivers the pending accesses of the state to onDataMemoryAccessBatch */
+    void flushMemoryAccesses(S2EExecutionState *state);
+
     /** Signal that is emitted on beginning and end of code generation
         for each QEMU translation block.
     */
@@ -187,12 +227,14 @@ public:
 
     /** Signal that is emitted on each memory access */
     /* XXX: this signal is still not emitted for code */
-    sigc::signal<void, S2EExecutionState*,
-                 klee::ref<klee::Expr> /* virtualAddress */,
-                 klee::ref<klee::Expr> /* hostAddress */,
-                 klee::ref<klee::Expr> /* value */,
-                 bool /* isWrite */, bool /* isIO */, bool /* isCode */>
-            onDataMemoryAccess;
+    DataMemoryAccessSignal onDataMemoryAccess;
+
+    /**
+     * Same as onDataMemoryAccess, but accesses are buffered in the
+     * state and delivered in batches, at the latest at the end of the
+     * translation block. Concrete accesses do not allocate expressions.
+     */
+    MemoryAccessBatchSignal onDataMemoryAccessBatch;
 
     /**
      * Signal that is emitted on each memory read.
@@ -224,11 +266,7 @@ public:
                 onHijackMemoryWrite;
 
     /** Signal that is emitted on each port access */
-    sigc::signal<void, S2EExecutionState*,
-                 klee::ref<klee::Expr> /* port */,
-                 klee::ref<klee::Expr> /* value */,
-                 bool /* isWrite */>
-            onPortAccess;
+    PortAccessSignal onPortAccess;
 
     sigc::signal<void> onTimer;
 
@@ -0,0 +1,96 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+#ifndef S2E_PLUGINS_EXECUTIONTRACER_H
+#define S2E_PLUGINS_EXECUTIONTRACER_H
+
+#include <s2e/Plugin.h>
+#include <s2e/Plugins/CorePlugin.h>
+#include <s2e/Plugins/TraceEntries.h>
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace s2e {
+
+/**
+ * Writes fork, state switch, kill and test case events to a binary
+ * trace file in the output directory of each S2E process.
+ * See TraceEntries.h for the file layout.
+ */
+class ExecutionTracer : public Plugin
+{
+    S2E_PLUGIN
+public:
+    ExecutionTracer(S2E* s2e);
+    virtual ~ExecutionTracer();
+
+    void initialize();
+
+private:
+    std::string m_fileName;
+    FILE *m_file;
+
+    std::vector<ExecutionTraceRecord> m_chunk;
+    unsigned m_chunkUsed;
+    uint64_t m_testCaseCount;
+
+    bool openTraceFile();
+    void flushChunk();
+
+    void writeRecord(S2EExecutionState *state, ExecutionTraceRecordType type,
+                     uint32_t arg0 = 0, uint64_t arg1 = 0);
+
+    void onStateFork(S2EExecutionState *state,
+                     const std::vector<S2EExecutionState*> &newStates,
+                     const std::vector<klee::ref<klee::Expr> > &newConditions);
+
+    void onStateSwitch(S2EExecutionState *currentState,
+                       S2EExecutionState *nextState);
+
+    void onStateKill(S2EExecutionState *state);
+
+    void onTestCaseGeneration(S2EExecutionState *state, const std::string &message);
+
+    void onProcessFork(bool preFork, bool isChild, unsigned parentProcId);
+
+    void onTimer();
+};
+
+}
+
+#endif
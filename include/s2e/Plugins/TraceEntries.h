@@ -0,0 +1,196 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+#ifndef S2E_PLUGINS_TRACEENTRIES_H
+#define S2E_PLUGINS_TRACEENTRIES_H
+
+#include <inttypes.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Binary layout of the files written by the ExecutionTracer plugin.
+ *
+ * A trace file starts with one ExecutionTraceHeader, followed by
+ * fixed-size ExecutionTraceRecords. Records are written in chunks of
+ * S2E_TRACE_CHUNK_RECORDS, so a file can be mapped and indexed directly.
+ * Each S2E process writes its own file in its own output directory.
+ * The records carry the process index so that files can be merged.
+ */
+
+namespace s2e {
+
+#define S2E_TRACE_MAGIC "S2ETRACE"
+#define S2E_TRACE_VERSION 1
+#define S2E_TRACE_CHUNK_RECORDS 2048
+
+enum ExecutionTraceRecordType {
+    TRACE_FORK = 1,
+    TRACE_STATE_SWITCH = 2,
+    TRACE_STATE_KILL = 3,
+    TRACE_TESTCASE = 4,
+    TRACE_MAX
+};
+
+struct ExecutionTraceHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t processIndex;
+    uint32_t reserved;
+    uint64_t startTime;     //Microseconds since the epoch
+} __attribute__((packed));
+
+/**
+ * Meaning of the arguments per record type:
+ * TRACE_FORK:         arg0 = id of the new state, arg1 = index among the new states
+ * TRACE_STATE_SWITCH: arg0 = id of the next state (stateId is -1 if none was running)
+ * TRACE_STATE_KILL:   no arguments
+ * TRACE_TESTCASE:     arg1 = number of the test case in this process
+ */
+struct ExecutionTraceRecord {
+    uint64_t timestamp;     //Microseconds since the epoch
+    uint64_t pc;
+    uint32_t stateId;
+    uint32_t processIndex;
+    uint16_t type;
+    uint16_t reserved;
+    uint32_t arg0;
+    uint64_t arg1;
+} __attribute__((packed));
+
+static inline bool isValidTraceHeader(const ExecutionTraceHeader *hdr)
+{
+    return !memcmp(hdr->magic, S2E_TRACE_MAGIC, sizeof(hdr->magic)) &&
+            hdr->version == S2E_TRACE_VERSION &&
+            hdr->recordSize == sizeof(ExecutionTraceRecord);
+}
+
+#ifndef _WIN32
+/**
+ * Maps a trace file read-only and gives indexed access to its records.
+ * A truncated last record (e.g., after a crash) is ignored.
+ */
+class ExecutionTraceReader
+{
+private:
+    int m_fd;
+    uint8_t *m_data;
+    uint64_t m_size;
+    uint64_t m_count;
+
+    ExecutionTraceReader(const ExecutionTraceReader&);
+    void operator=(const ExecutionTraceReader&);
+
+public:
+    ExecutionTraceReader() : m_fd(-1), m_data(NULL), m_size(0), m_count(0) {}
+
+    ~ExecutionTraceReader() {
+        close();
+    }
+
+    bool open(const char *fileName) {
+        close();
+
+        m_fd = ::open(fileName, O_RDONLY);
+        if (m_fd < 0) {
+            return false;
+        }
+
+        struct stat st;
+        if (fstat(m_fd, &st) < 0 || (uint64_t) st.st_size < sizeof(ExecutionTraceHeader)) {
+            close();
+            return false;
+        }
+
+        m_size = st.st_size;
+        void *data = mmap(NULL, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+        if (data == MAP_FAILED) {
+            close();
+            return false;
+        }
+        m_data = (uint8_t*) data;
+
+        if (!isValidTraceHeader(getHeader())) {
+            close();
+            return false;
+        }
+
+        m_count = (m_size - sizeof(ExecutionTraceHeader)) / sizeof(ExecutionTraceRecord);
+        return true;
+    }
+
+    void close() {
+        if (m_data) {
+            munmap(m_data, m_size);
+        }
+        if (m_fd >= 0) {
+            ::close(m_fd);
+        }
+        m_fd = -1;
+        m_data = NULL;
+        m_size = 0;
+        m_count = 0;
+    }
+
+    const ExecutionTraceHeader *getHeader() const {
+        return (const ExecutionTraceHeader*) m_data;
+    }
+
+    uint64_t getRecordCount() const {
+        return m_count;
+    }
+
+    const ExecutionTraceRecord *getRecord(uint64_t index) const {
+        if (index >= m_count) {
+            return NULL;
+        }
+        const uint8_t *records = m_data + sizeof(ExecutionTraceHeader);
+        return (const ExecutionTraceRecord*) (records + index * sizeof(ExecutionTraceRecord));
+    }
+};
+#endif
+
+}
+
+#endif
@@ -69,7 +69,9 @@ class S2EExecutionState;
 
 class Database;
 
-//Structure used for synchronization among multiple instances of S2E
+//Structure used for synchronization among multiple instances of S2E.
+//All fields are accessed with AtomicFunctions. The lock is only taken
+//for structural changes, like reclaiming the slots of dead instances.
 struct S2EShared {
     unsigned currentProcessCount;
     unsigned lastFileId;
@@ -83,10 +85,16 @@ struct S2EShared {
     //the instance index.
     unsigned processIds[S2E_MAX_PROCESSES];
     unsigned processPids[S2E_MAX_PROCESSES];
+
+    //Number of schedulable states of each running instance.
+    //Load balancing uses it to decide which instance gives away work.
+    unsigned processStateCounts[S2E_MAX_PROCESSES];
+
     S2EShared() {
         for (unsigned i=0; i<S2E_MAX_PROCESSES; ++i)    {
             processIds[i] = (unsigned)-1;
             processPids[i] = (unsigned)-1;
+            processStateCounts[i] = 0;
         }
     }
 };
@@ -119,6 +127,9 @@ protected:
 
     uint64_t m_startTimeSeconds;
 
+    /* When the log files were last flushed */
+    mutable uint64_t m_lastFlushSeconds;
+
     /* How many processes can S2E fork */
     unsigned m_maxProcesses;
     unsigned m_currentProcessIndex;
@@ -203,6 +214,9 @@ public:
 
     static void printf(llvm::raw_ostream &os, const char *fmt, ...);
 
+    /** Writes out everything buffered in the log files */
+    void flushOutputStreams() const;
+
     /***********************/
     /* Runtime information */
     S2EExecutor* getExecutor() { return m_s2eExecutor; }
@@ -210,10 +224,6 @@ public:
 
     void registerPlugin(const PluginInfo* info) {m_pluginsFactory->registerPlugin(info);}
 
-    //XXX: A plugin can hold cached state information. When a state is deleted,
-    //remove all the cached info from all plugins.
-    void refreshPlugins();
-
     void writeBitCodeToFile();
 
     int fork();
@@ -238,6 +248,13 @@ public:
 
     unsigned getCurrentProcessCount();
 
+    /** Publishes the number of schedulable states of this instance */
+    void setCurrentStateCount(unsigned count);
+    unsigned getStateCount(unsigned id);
+
+    /** Returns true if no other instance has more schedulable states */
+    bool isMostLoadedProcess();
+
     bool checkDeadProcesses();
 
     inline uint64_t getStartTime() const {
@@ -74,6 +74,9 @@ private:
 
     uint8_t *m_stateBuffer;
 
+    /* Memory used by the device snapshots of all states */
+    static uint64_t s_snapshotBytes;
+
 
     static llvm::SmallVector<struct BlockDriverState*, 5> s_blockDevices;
     klee::AddressSpace m_deviceState;
@@ -107,6 +110,10 @@ public:
     int putBuffer(const uint8_t *buf, int64_t pos, int size);
     int getBuffer(uint8_t *buf, int64_t pos, int size);
 
+    static uint64_t getSnapshotBytes() {
+        return s_snapshotBytes;
+    }
+
     int writeSector(struct BlockDriverState *bs, int64_t sector, const uint8_t *buf, int nb_sectors);
     int readSector(struct BlockDriverState *bs, int64_t sector, uint8_t *buf, int nb_sectors);
 };
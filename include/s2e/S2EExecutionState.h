@@ -39,9 +39,11 @@
 #include <klee/ExecutionState.h>
 #include <klee/Memory.h>
 #include <cpu.h>
+#include "Plugin.h"
 #include "S2EDeviceState.h"
 #include "S2EStatsTracker.h"
 #include "MemoryCache.h"
+#include "MemoryAccessBuffer.h"
 #include "s2e_config.h"
 
 /** S2E_TARGET_CONC_LIMIT defines the border between concrete and symbolic area.
@@ -75,6 +77,8 @@ CPUArchState;
 #include <llvm/ADT/DenseMap.h>
 #include <llvm/ADT/SmallVector.h>
 #include <unordered_map>
+#include <unordered_set>
+#include <memory>
 
 namespace s2e {
 
@@ -84,8 +88,8 @@ class S2EDeviceState;
 class S2EExecutionState;
 struct S2ETranslationBlock;
 
-//typedef std::unordered_map<const Plugin*, PluginState*> PluginStateMap;
-typedef std::map<const Plugin*, PluginState*> PluginStateMap;
+//Indexed by Plugin::getIndex(), NULL until the plugin asks for its state
+typedef llvm::SmallVector<PluginState*, 8> PluginStateMap;
 typedef PluginState* (*PluginStateFactory)(Plugin *p, S2EExecutionState *s);
 
 typedef MemoryCachePool<klee::ObjectPair,
@@ -105,6 +109,35 @@ struct S2EPhysCacheEntry
     }
 };
 
+/** Caches virtual to physical translations done by getPhysicalAddress */
+struct S2ETranslationCacheEntry
+{
+    uint64_t virtualPage;
+    uint64_t physicalPage;
+    uint64_t generation;
+
+    S2ETranslationCacheEntry() {
+        virtualPage = (uint64_t) -1;
+        physicalPage = (uint64_t) -1;
+        generation = 0;
+    }
+};
+
+/** RAM objects whose saved copy a state updated, either from the host
+    memory on a state switch or fork, or directly while inactive.
+    A forked state shares the log of its parent and records its own
+    updates in a new node, so two states can only disagree on the
+    objects logged below their closest common node. */
+struct RamWriteLog
+{
+    std::shared_ptr<RamWriteLog> parent;
+    unsigned depth;
+    std::unordered_set<const klee::MemoryObject*> objects;
+};
+
+#define S2E_TRANSLATION_CACHE_BITS 5
+#define S2E_TRANSLATION_CACHE_SIZE (1 << S2E_TRANSLATION_CACHE_BITS)
+
 class S2EExecutionState : public klee::ExecutionState
 {
 protected:
@@ -112,6 +145,23 @@ protected:
 
     static unsigned s_lastSymbolicId;
 
+    /** Why merge attempts ended, used to tune merge points */
+    enum MergeOutcome {
+        MergeSucceeded,
+        MergeDifferentPc,
+        MergeDifferentStack,
+        MergeDifferentSymbolics,
+        MergeDifferentCpuState,
+        MergeDifferentAddressMap,
+        MergeSharedConcreteMutated,
+        MergeOutcomeCount
+    };
+
+    static const char *s_mergeOutcomeNames[MergeOutcomeCount];
+    static uint64_t s_mergeOutcomes[MergeOutcomeCount];
+
+    bool rejectMerge(MergeOutcome reason) const;
+
     /** Unique numeric ID for the state */
     int m_stateID;
 
@@ -143,6 +193,13 @@ protected:
     */
     bool m_runningConcrete;
 
+    /** Cached result of getSymbolicRegistersMask. Native code cannot
+        change which registers are symbolic, so the cache is only used
+        in concrete mode and is dropped on mode switches and on writes
+        to the register ObjectState. */
+    mutable uint64_t m_symbolicRegistersMask;
+    mutable bool m_symbolicRegistersMaskValid;
+
     typedef std::set<std::pair<uint64_t,uint64_t> > ToRunSymbolically;
     ToRunSymbolically m_toRunSymbolically;
 
@@ -163,6 +220,25 @@ protected:
 
     mutable S2EMemoryCache m_memcache;
 
+    /* NULL until the state saves or modifies a RAM object */
+    std::shared_ptr<RamWriteLog> m_ramWriteLog;
+
+    void logRamWrite(const klee::MemoryObject *mo);
+
+    /* Writes to the saved copy of shared RAM must be restored when
+       the state is activated again */
+    void logInactiveRamWrite(const klee::MemoryObject *mo) {
+        if (!m_active && mo->isSharedConcrete) {
+            logRamWrite(mo);
+        }
+    }
+
+    /* Page walks done on behalf of plugins. Entries are only valid
+       for the current page directory and TLB contents, bumping the
+       generation invalidates all of them at once. */
+    mutable S2ETranslationCacheEntry m_translationCache[S2E_TRANSLATION_CACHE_SIZE];
+    uint64_t m_translationCacheGeneration;
+
     /* The following structure is used to store QEMU time accounting
        variables while the state is inactive */
     TimersState* m_timersState;
@@ -178,6 +254,9 @@ protected:
 
     S2EStateStats m_stats;
 
+    /* Accesses not yet delivered to onDataMemoryAccessBatch */
+    MemoryAccessBuffer m_memoryAccesses;
+
     /**
      * The following optimizes tracks the location of every ObjectState
      * in the TLB in order to optimize TLB updates.
@@ -198,6 +277,10 @@ protected:
 
     std::string getUniqueVarName(const std::string &name);
 
+    /* Bulk accessors for host ranges that lie within one guest page */
+    bool readRamConcreteRun(uint64_t hostAddress, uint8_t *buf, uint64_t size);
+    void writeRamConcreteRun(uint64_t hostAddress, const uint8_t *buf, uint64_t size);
+
 public:
     enum AddressType {
         VirtualAddress, PhysicalAddress, HostAddress
@@ -217,15 +300,30 @@ public:
     uint64_t getTotalInstructionCount();
     /*************************************************/
 
+    const PluginState* getPluginStateConst(Plugin *plugin, PluginStateFactory factory) {
+        unsigned index = plugin->getIndex();
+        if (index < m_PluginState.size() && m_PluginState[index]) {
+            return m_PluginState[index];
+        }
+
+        if (index >= m_PluginState.size()) {
+            m_PluginState.resize(index + 1, NULL);
+        }
+        PluginState *ret = factory(plugin, this);
+        assert(ret);
+        m_PluginState[index] = ret;
+        return ret;
+    }
+
     PluginState* getPluginState(Plugin *plugin, PluginStateFactory factory) {
-        PluginStateMap::iterator it = m_PluginState.find(plugin);
-        if (it == m_PluginState.end()) {
-            PluginState *ret = factory(plugin, this);
-            assert(ret);
-            m_PluginState[plugin] = ret;
-            return ret;
+        PluginState *ret = const_cast<PluginState*>(getPluginStateConst(plugin, factory));
+        if (ret->m_refCount > 1) {
+            //Shared with other states, take a private copy before writing
+            --ret->m_refCount;
+            ret = ret->clone();
+            m_PluginState[plugin->getIndex()] = ret;
         }
-        return (*it).second;
+        return ret;
     }
 
     /** Returns true if this is the active state */
@@ -241,12 +339,20 @@ public:
         m_yielded = new_yield_state;
     }
 
+    MemoryAccessBuffer &getMemoryAccessBuffer() {
+        return m_memoryAccesses;
+    }
+
     /** Returns true if this state is currently running in concrete mode */
     bool isRunningConcrete() const { return m_runningConcrete; }
 
     /** Returns a mask of registers that contains symbolic values */
     uint64_t getSymbolicRegistersMask() const;
 
+    void invalidateSymbolicRegistersMask() {
+        m_symbolicRegistersMaskValid = false;
+    }
+
     /** Read CPU general purpose register */
     klee::ref<klee::Expr> readCpuRegister(unsigned offset,
                                           klee::Expr::Width width) const;
@@ -448,11 +554,25 @@ public:
     /** Attempt to merge two states */
     bool merge(const ExecutionState &b);
 
+    /** Prints how many merge attempts ended for each reason */
+    static void printMergeStatistics(llvm::raw_ostream &os);
+
     void updateTlbEntry(CPUArchState* env,
                               int mmu_idx, uint64_t virtAddr, uint64_t hostAddr);
     void flushTlbCache();
 
     void flushTlbCachePage(klee::ObjectState *objectState, int mmu_idx, int index);
+
+    /** Drops the cached virtual to physical translations */
+    void flushTranslationCache() {
+        ++m_translationCacheGeneration;
+    }
+
+    /** Drops the cached translation of the pages that map to the given
+        index of the QEMU TLB. Generations start at 1, so 0 never matches. */
+    void flushTranslationCachePage(int index) {
+        m_translationCache[index & (S2E_TRANSLATION_CACHE_SIZE - 1)].generation = 0;
+    }
 };
 
 //Some convenience macros
@@ -40,6 +40,10 @@
 #include <llvm/Support/raw_ostream.h>
 #include <cpu.h>
 
+#include <s2e/Signals.h>
+
+#include <memory>
+
 class TCGLLVMContext;
 
 struct TranslationBlock;
@@ -54,6 +58,9 @@ namespace s2e {
 class S2E;
 class S2EExecutionState;
 struct S2ETranslationBlock;
+struct RamWriteLog;
+class DirtyPageTracker;
+class TBProfiler;
 
 class CpuExitException
 {
@@ -100,6 +107,29 @@ protected:
 
     std::vector<klee::MemoryObject*> m_saveOnContextSwitch;
 
+    /* Objects of m_saveOnContextSwitch outside the RAM regions
+       covered by m_dirtyPages, always copied on a switch */
+    std::vector<klee::MemoryObject*> m_saveOnContextSwitchUntracked;
+
+    /* Tracks RAM pages written since the last state switch,
+       NULL if every object is copied on each switch */
+    DirtyPageTracker* m_dirtyPages;
+
+    /* Log of the state whose RAM is in the host memory while no
+       state is active (e.g., during a merge) */
+    std::shared_ptr<RamWriteLog> m_hostRamLog;
+    bool m_hostRamLogValid;
+
+    /* Scratch buffers of saveDirtyRam and restoreDirtyRam */
+    std::vector<uintptr_t> m_dirtyPageList;
+    std::vector<const klee::MemoryObject*> m_ramRestoreList;
+
+    /* Per translation block counters, NULL unless profiling is enabled */
+    TBProfiler* m_tbProfiler;
+
+    /* Backing store for the execution signals of all translation blocks */
+    ExecutionSignalPool m_executionSignalPool;
+
     std::vector<S2EExecutionState*> m_deletedStates;
 
     bool m_executeAlwaysKlee;
@@ -213,6 +243,14 @@ public:
 
     void unrefS2ETb(S2ETranslationBlock* s2e_tb);
 
+    ExecutionSignalPool &getExecutionSignalPool() {
+        return m_executionSignalPool;
+    }
+
+    TCGLLVMContext *getTCGLLVMContext() const {
+        return m_tcgLLVMContext;
+    }
+
     void queueStateForMerge(S2EExecutionState *state);
 
     void initializeStatistics();
@@ -278,6 +316,8 @@ protected:
     void prepareFunctionExecution(S2EExecutionState *state,
                            llvm::Function* function,
                            const std::vector<klee::ref<klee::Expr> >& args);
+    void registerFunctionAddress(llvm::Function *f);
+    void registerReferencedFunctions(llvm::Function *function);
     bool executeInstructions(S2EExecutionState *state, unsigned callerStackSize = 1);
 
     uintptr_t executeTranslationBlockKlee(S2EExecutionState *state,
@@ -295,6 +335,10 @@ protected:
                      const std::vector<S2EExecutionState*>& newStates,
                      const std::vector<klee::ref<klee::Expr> >& conditions);
 
+    void saveDirtyRam(S2EExecutionState *state, uint64_t &bytes, uint64_t &count);
+    void restoreDirtyRam(S2EExecutionState *oldState, S2EExecutionState *newState,
+                         uint64_t &bytes, uint64_t &count);
+
     void doLoadBalancing();
 
     /** Copy concrete values to their proper location, concretizing
@@ -438,14 +482,17 @@ struct S2ETranslationBlock
     unsigned refCount;
 
     /** A copy of TranslationBlock::llvm_function that can be used
-        even after TranslationBlock is destroyed */
+        even after TranslationBlock is destroyed. The function may be
+        shared with identical blocks, the reference of this block is
+        released when refCount drops to zero. */
     llvm::Function* llvm_function;
 
     /** A list of all instruction execution signals associated with
-        this basic block. All signals in the list will be deleted
-        when this translation block will be flushed.
-        XXX: how could we avoid using void* here ? */
-    std::vector<void*> executionSignals;
+        this basic block. The last signal is always empty and is used
+        for the next instrumentation point. All signals in the list are
+        returned to the ExecutionSignalPool when this translation block
+        is flushed. */
+    std::vector<ExecutionSignal*> executionSignals;
 };
 
 } // namespace s2e
@@ -51,6 +51,13 @@ namespace stats {
 
     extern klee::Statistic concreteModeTime;
     extern klee::Statistic symbolicModeTime;
+
+    extern klee::Statistic stateMergeAttempts;
+    extern klee::Statistic stateMerges;
+    extern klee::Statistic stateMergeTime;
+
+    extern klee::Statistic functionPreparations;
+    extern klee::Statistic functionPreparationTime;
 } // namespace stats
 } // namespace klee
 
@@ -64,6 +71,7 @@ public:
         : StatsTracker(_executor, _objectFilename, _updateMinDistToUncovered) {}
 
     static uint64_t getProcessMemoryUsage();
+    static uint64_t getProcessResidentMemory();
 protected:
     void writeStatsHeader();
     void writeStatsLine();
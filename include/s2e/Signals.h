@@ -0,0 +1,296 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+#ifndef S2E_SIGNALS_H
+#define S2E_SIGNALS_H
+
+#include <sigc++/sigc++.h>
+#include <vector>
+#include <stddef.h>
+#include <inttypes.h>
+#include <assert.h>
+
+#include "s2e_config.h"
+
+namespace s2e {
+
+/**
+ * A lightweight replacement for sigc::signal used on the hot paths
+ * (instruction execution, memory and port accesses).
+ *
+ * Subscribers are stored in a contiguous array of function pointer and
+ * context pairs. Emission does not allocate and does not touch any of the
+ * sigc++ bookkeeping. Plugins may either register a raw callback, which is
+ * called directly, or a regular sigc++ slot, which is wrapped into a
+ * trampoline.
+ *
+ * Connecting a slot returns a sigc::connection, as with sigc::signal.
+ * A slot that is disconnected, or whose sigc::trackable object gets
+ * destroyed, becomes a no-op and is removed from the array before the
+ * next emission, so that empty() becomes true again once all subscribers
+ * are gone. Raw callbacks are removed with disconnect().
+ *
+ * Only void signals are supported.
+ */
+template<typename... Args>
+class FastSignal {
+public:
+    typedef sigc::slot<void, Args...> Slot;
+    typedef void (*Function)(void *context, Args...);
+
+private:
+    struct Subscriber {
+        Function function;
+        void *context;
+        Slot *slot;
+    };
+
+    mutable std::vector<Subscriber> m_subscribers;
+
+    /* Set when a subscriber must be removed outside of an emission */
+    mutable bool m_hasDeadSubscribers;
+    mutable unsigned m_emitDepth;
+
+    struct EmitGuard {
+        const FastSignal *signal;
+        EmitGuard(const FastSignal *s) : signal(s) { ++signal->m_emitDepth; }
+        ~EmitGuard() { --signal->m_emitDepth; }
+    };
+
+    static void callSlot(void *context, Args... args) {
+        (*static_cast<Slot*>(context))(args...);
+    }
+
+    static void ignore(void *, Args...) {
+    }
+
+    /* Called by sigc++ when a slot is disconnected or its trackable dies.
+       The slot is still in use at that point, it is freed later. */
+    static void *onSlotInvalidated(void *data) {
+        static_cast<FastSignal*>(data)->m_hasDeadSubscribers = true;
+        return NULL;
+    }
+
+    //Kept out of line so that emit() stays small enough to be inlined
+    __attribute__((noinline)) void removeDeadSubscribers() const {
+        size_t j = 0;
+        for (size_t i = 0; i < m_subscribers.size(); ++i) {
+            Subscriber &s = m_subscribers[i];
+            bool dead = s.slot ? s.slot->empty() : s.function == &FastSignal::ignore;
+            if (dead) {
+                deleteSlot(s.slot);
+            } else {
+                m_subscribers[j++] = s;
+            }
+        }
+        m_subscribers.resize(j);
+        m_hasDeadSubscribers = false;
+    }
+
+    static void deleteSlot(Slot *slot) {
+        if (slot) {
+            slot->set_parent(NULL, NULL);
+            delete slot;
+        }
+    }
+
+    FastSignal(const FastSignal&);
+    FastSignal& operator=(const FastSignal&);
+
+public:
+    FastSignal() : m_hasDeadSubscribers(false), m_emitDepth(0) {}
+
+    ~FastSignal() {
+        clear();
+    }
+
+    /** Registers a raw callback. This is the cheapest kind of subscriber. */
+    void connect(Function function, void *context) {
+        Subscriber s = { function, context, NULL };
+        m_subscribers.push_back(s);
+    }
+
+    /** Removes a raw callback, returns false if it was not connected */
+    bool disconnect(Function function, void *context) {
+        for (size_t i = 0; i < m_subscribers.size(); ++i) {
+            Subscriber &s = m_subscribers[i];
+            if (s.slot || s.function != function || s.context != context) {
+                continue;
+            }
+
+            //Removing while emitting would shift the subscribers being called
+            if (m_emitDepth) {
+                s.function = &FastSignal::ignore;
+                m_hasDeadSubscribers = true;
+            } else {
+                m_subscribers.erase(m_subscribers.begin() + i);
+            }
+            return true;
+        }
+        return false;
+    }
+
+    /** Registers a sigc++ slot, e.g., sigc::mem_fun(*this, &Plugin::onExecute) */
+    sigc::connection connect(const Slot &slot) {
+        Slot *copy = new Slot(slot);
+        copy->set_parent(this, &FastSignal::onSlotInvalidated);
+        Subscriber s = { &FastSignal::callSlot, copy, copy };
+        m_subscribers.push_back(s);
+        return sigc::connection(*copy);
+    }
+
+    void clear() {
+        assert(!m_emitDepth && "Cannot clear a signal while emitting it");
+        for (size_t i = 0; i < m_subscribers.size(); ++i) {
+            deleteSlot(m_subscribers[i].slot);
+        }
+        m_subscribers.clear();
+        m_hasDeadSubscribers = false;
+    }
+
+    bool empty() const {
+        if (m_hasDeadSubscribers && !m_emitDepth) {
+            removeDeadSubscribers();
+        }
+        return m_subscribers.empty();
+    }
+
+    size_t size() const {
+        if (m_hasDeadSubscribers && !m_emitDepth) {
+            removeDeadSubscribers();
+        }
+        return m_subscribers.size();
+    }
+
+    inline void emit(Args... args) const {
+        if (__builtin_expect(m_hasDeadSubscribers, 0) && !m_emitDepth) {
+            removeDeadSubscribers();
+        }
+
+        size_t count = m_subscribers.size();
+        if (count == 0) {
+            return;
+        }
+
+        EmitGuard guard(this);
+        if (count == 1) {
+            const Subscriber &s = m_subscribers[0];
+            s.function(s.context, args...);
+            return;
+        }
+
+        //Subscribers may connect new handlers while we iterate,
+        //so index the array on each iteration.
+        for (size_t i = 0; i < count; ++i) {
+            const Subscriber &s = m_subscribers[i];
+            s.function(s.context, args...);
+        }
+    }
+
+    inline void operator()(Args... args) const {
+        emit(args...);
+    }
+};
+
+class S2EExecutionState;
+
+/** A type of a signal emitted on instruction execution. Instances of this signal
+    are taken from the ExecutionSignalPool during translation and returned to it
+    when the translation block is flushed. */
+#ifdef S2E_USE_FAST_SIGNALS
+typedef FastSignal<S2EExecutionState*, uint64_t /* pc */> ExecutionSignal;
+#else
+typedef sigc::signal<void, S2EExecutionState*, uint64_t /* pc */> ExecutionSignal;
+#endif
+
+/**
+ * Recycles execution signals across translation blocks.
+ *
+ * Signals are carved out of fixed-size chunks that are never freed
+ * while the pool is alive, so their addresses can be embedded in the
+ * generated code. Released signals are cleared and put on a free list.
+ * Clearing keeps the capacity of the subscriber array, so a recycled
+ * signal usually does not allocate when plugins connect to it again.
+ */
+class ExecutionSignalPool {
+public:
+    static const unsigned CHUNK_SIGNALS = 256;
+
+private:
+    std::vector<ExecutionSignal*> m_chunks;
+    std::vector<ExecutionSignal*> m_free;
+    uint64_t m_liveSignals;
+
+    ExecutionSignalPool(const ExecutionSignalPool&);
+    ExecutionSignalPool& operator=(const ExecutionSignalPool&);
+
+    void grow();
+
+public:
+    ExecutionSignalPool();
+    ~ExecutionSignalPool();
+
+    ExecutionSignal *allocate() {
+        if (m_free.empty()) {
+            grow();
+        }
+        ExecutionSignal *signal = m_free.back();
+        m_free.pop_back();
+        ++m_liveSignals;
+        return signal;
+    }
+
+    void release(ExecutionSignal *signal) {
+        signal->clear();
+        m_free.push_back(signal);
+        --m_liveSignals;
+    }
+
+    /** Returns all the signals of a translation block at once */
+    void release(std::vector<ExecutionSignal*> &signals);
+
+    uint64_t getLiveSignals() const {
+        return m_liveSignals;
+    }
+
+    uint64_t getCapacity() const {
+        return (uint64_t) m_chunks.size() * CHUNK_SIGNALS;
+    }
+};
+
+}
+
+#endif // S2E_SIGNALS_H
@@ -131,6 +131,7 @@ private:
     typedef std::set<uintptr_t, RegCmp> RegionSet;
     RegionMap m_regions;
     RegionSet m_busyRegions;
+    uint64_t m_mappedRegions;
 
 private:
     inline uintptr_t getRegionSize() const {
@@ -152,6 +153,10 @@ public:
     }
 
     bool belongsToUs(uintptr_t addr) const;
+
+    uint64_t getMappedBytes() const {
+        return m_mappedRegions * getRegionSize();
+    }
 };
 
 
@@ -282,11 +287,16 @@ public:
 
     void printStats(std::ostream &os) const;
 
+    /** Bytes handed out to callers, rounded up to the block sizes */
+    uint64_t getAllocatedBytes() const;
+
     const PageAllocator *getPageAllocator() const {
         return m_pa;
     }
 };
 
+void slab_print_stats(std::ostream &os);
+
 }
 
 
@@ -38,6 +38,7 @@
 
 #include <inttypes.h>
 #include <string>
+#include <new>
 
 namespace s2e {
 
@@ -112,6 +113,15 @@ public:
     static void write(uint64_t *address, uint64_t value);
     static void add(uint64_t *address, uint64_t value);
     static void sub(uint64_t *address, uint64_t value);
+
+    /* 32-bit variants, meant for counters in shared memory */
+    static unsigned read(unsigned *address);
+    static void write(unsigned *address, unsigned value);
+    static unsigned fetchAndAdd(unsigned *address, unsigned value);
+    static unsigned fetchAndSub(unsigned *address, unsigned value);
+
+    /* Returns the value before the operation */
+    static unsigned compareAndSwap(unsigned *address, unsigned oldValue, unsigned newValue);
 };
 
 template <class T>
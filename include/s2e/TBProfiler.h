@@ -0,0 +1,118 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+#ifndef S2E_TBPROFILER_H
+#define S2E_TBPROFILER_H
+
+#include <inttypes.h>
+#include <string>
+#include <vector>
+
+namespace s2e {
+
+class S2E;
+
+/**
+ * Per translation block counters, keyed by the guest pc of the block.
+ * Entries live in a fixed-size open-addressed table, so recording an
+ * event costs a hash and a few increments. Blocks that do not fit in
+ * the table are accumulated in a single overflow entry.
+ */
+class TBProfiler
+{
+public:
+    struct Entry {
+        uint64_t pc;
+        uint64_t concreteExecutions;
+        uint64_t symbolicExecutions;
+        uint64_t llvmInstructions;
+        uint64_t forks;
+        uint64_t symbolicTime;      //Microseconds
+    };
+
+private:
+    S2E *m_s2e;
+    std::vector<Entry> m_entries;
+    uint64_t m_mask;
+    Entry m_overflow;
+
+    /* Entry of the block executing in KLEE, it gets the forks */
+    Entry *m_current;
+
+    unsigned m_dumpInterval;
+    unsigned m_ticks;
+
+    Entry *lookup(uint64_t pc);
+
+public:
+    /** sizeBits is the log2 of the number of table entries */
+    TBProfiler(S2E *s2e, unsigned sizeBits, unsigned dumpInterval);
+
+    inline void recordConcrete(uint64_t pc) {
+        ++lookup(pc)->concreteExecutions;
+    }
+
+    inline void beginSymbolic(uint64_t pc) {
+        m_current = lookup(pc);
+        ++m_current->symbolicExecutions;
+    }
+
+    inline void endSymbolic(uint64_t llvmInstructions, uint64_t time) {
+        if (m_current) {
+            m_current->llvmInstructions += llvmInstructions;
+            m_current->symbolicTime += time;
+            m_current = NULL;
+        }
+    }
+
+    inline void recordFork() {
+        if (m_current) {
+            ++m_current->forks;
+        }
+    }
+
+    void clear();
+
+    /** Writes the sorted report and the collapsed stacks for flame graphs */
+    void dump();
+
+    /** Dumps every m_dumpInterval timer ticks */
+    void onTimer();
+};
+
+}
+
+#endif
@@ -0,0 +1,76 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+#ifndef TCG_LLVM_KEY_H
+#define TCG_LLVM_KEY_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+struct TCGContext;
+struct TranslationBlock;
+
+/**
+ * Identifies the LLVM code of a translation block by its contents.
+ *
+ * The key covers the guest pc, the TCG op stream and its arguments, the
+ * temporaries it uses and the translation block flags. The op stream
+ * also contains host addresses (helpers, exit_tb values), so keys are
+ * only meaningful within one process. In practice two keys only match
+ * when the same block is translated again, e.g., after a tb_flush, and
+ * TCGLLVMContext uses them to reuse the function of the previous
+ * translation.
+ */
+struct TCGLLVMFunctionKey
+{
+    uint64_t hash[2];
+
+    bool operator==(const TCGLLVMFunctionKey &other) const {
+        return hash[0] == other.hash[0] && hash[1] == other.hash[1];
+    }
+
+    static TCGLLVMFunctionKey compute(const TCGContext *s,
+                                      const TranslationBlock *tb);
+};
+
+struct TCGLLVMFunctionKeyHash
+{
+    size_t operator()(const TCGLLVMFunctionKey &key) const {
+        return key.hash[0];
+    }
+};
+
+#endif
@@ -98,6 +98,8 @@ int tcg_llvm_search_last_pc(struct TranslationBlock *tb, CPUArchState *env, uint
 /***********************************/
 /* External interface for C++ code */
 
+#include <vector>
+
 namespace llvm {
     class Function;
     class LLVMContext;
@@ -129,6 +131,38 @@ public:
     void deleteExecutionEngine();
     llvm::legacy::FunctionPassManager* getFunctionPassManager() const;
 
+    /** A block retranslated with the same pc, flags and TCG code reuses
+        the function of its previous translation. Each block holds one
+        reference, taken when its code is generated. Unreferenced
+        functions are kept for reuse in an LRU list of at most
+        setMaxIdleFunctions entries. The functions that fall out of it,
+        and their optimized copies, are appended to evicted and must be
+        deleted by the caller. */
+    void releaseFunction(llvm::Function *function,
+                         std::vector<llvm::Function*> &evicted);
+
+    /** Size of the idle function list, 4096 by default. A smaller size
+        takes effect on the next releaseFunction call. */
+    void setMaxIdleFunctions(size_t count);
+
+    /** Returns a copy of the function optimized with the function pass
+        manager. The copy is created on the first call, shared by all
+        translations of the block and released with the function. */
+    llvm::Function *getOptimizedFunction(llvm::Function *function);
+
+    /** Number of functions optimized by getOptimizedFunction */
+    uint64_t getOptimizedFunctions() const;
+
+    /** Drops the reference of a translation block that is being freed */
+    void releaseBlock(struct TCGPluginTBData *data);
+
+    /** Number of retranslations that reused an existing function */
+    uint64_t getSharedFunctionHits() const;
+
+    /** Approximate memory used by translation block functions,
+        including optimized copies and native code */
+    uint64_t getFunctionBytes() const;
+
 #ifdef CONFIG_S2E
     /** Called after linking all helper libraries */
     void initializeHelpers();
@@ -141,6 +175,9 @@ public:
 struct TCGPluginTBData
 {
     llvm::Function *llvm_function;
+    /* Set once the block became hot, see getOptimizedFunction */
+    llvm::Function *llvm_optimized_function;
+    uint64_t execution_count;
     uint8_t * llvm_tc_ptr;
     uint8_t * llvm_tc_end;
     TCGLLVMContext *tcg_llvm_context;
@@ -0,0 +1,70 @@
+#!/usr/bin/env python
+#
+# Reads the binary traces written by the ExecutionTracer plugin.
+# The layout is described in include/s2e/Plugins/TraceEntries.h.
+#
+#   s2e_trace.py dump <file>...              print the records as text
+#   s2e_trace.py merge <output> <file>...    merge per-process traces by time
+
+import mmap
+import heapq
+import struct
+import sys
+
+MAGIC = b"S2ETRACE"
+VERSION = 1
+HEADER = struct.Struct("<8sIIIIQ")
+RECORD = struct.Struct("<QQIIHHIQ")
+
+TYPES = {1: "fork", 2: "switch", 3: "kill", 4: "testcase"}
+
+
+def read_trace(path):
+    """Yields (header, records) where records iterates over tuples
+    (timestamp, pc, stateId, processIndex, type, reserved, arg0, arg1)."""
+    f = open(path, "rb")
+    data = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+    header = HEADER.unpack_from(data, 0)
+    if header[0] != MAGIC or header[1] != VERSION or header[2] != RECORD.size:
+        raise ValueError("%s is not an S2E trace" % path)
+
+    def records():
+        count = (len(data) - HEADER.size) // RECORD.size
+        for i in range(count):
+            yield RECORD.unpack_from(data, HEADER.size + i * RECORD.size)
+
+    return header, records()
+
+
+def dump(paths):
+    for path in paths:
+        header, records = read_trace(path)
+        for r in records:
+            sys.stdout.write("%d node=%d state=%d %s pc=%#x arg0=%d arg1=%d\n" %
+                             (r[0], r[3], r[2], TYPES.get(r[4], r[4]), r[1], r[6], r[7]))
+
+
+def merge(output, paths):
+    traces = [read_trace(p) for p in paths]
+    start = min(h[5] for h, _ in traces)
+
+    out = open(output, "wb")
+    out.write(HEADER.pack(MAGIC, VERSION, RECORD.size, 0xffffffff, 0, start))
+    for r in heapq.merge(*[records for _, records in traces]):
+        out.write(RECORD.pack(*r))
+    out.close()
+
+
+def main(argv):
+    if len(argv) >= 3 and argv[1] == "dump":
+        dump(argv[2:])
+    elif len(argv) >= 4 and argv[1] == "merge":
+        merge(argv[2], argv[3:])
+    else:
+        sys.stderr.write("usage: %s dump <trace>... | merge <output> <trace>...\n" % argv[0])
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
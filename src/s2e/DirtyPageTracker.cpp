@@ -0,0 +1,251 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+#include "s2e/DirtyPageTracker.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+namespace s2e {
+
+DirtyPageTracker *DirtyPageTracker::s_instance = NULL;
+
+DirtyPageTracker::DirtyPageTracker()
+    : m_dirtyCount(0), m_handlerInstalled(false), m_lock(0)
+{
+#ifdef _WIN32
+    m_pageSize = 0x1000;
+#else
+    m_pageSize = sysconf(_SC_PAGESIZE);
+#endif
+}
+
+DirtyPageTracker::~DirtyPageTracker()
+{
+#ifndef _WIN32
+    if (m_handlerInstalled) {
+        sigaction(SIGSEGV, &m_oldAction, NULL);
+        s_instance = NULL;
+    }
+
+    for (const Region &r : m_regions) {
+        mprotect((void*) r.start, r.size, PROT_READ | PROT_WRITE);
+    }
+#endif
+
+    for (const Region &r : m_regions) {
+        delete [] r.dirty;
+    }
+}
+
+void DirtyPageTracker::installHandler()
+{
+#ifndef _WIN32
+    assert(!s_instance && "Only one dirty page tracker may be active");
+    s_instance = this;
+
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_sigaction = segvHandler;
+    act.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&act.sa_mask);
+
+    if (sigaction(SIGSEGV, &act, &m_oldAction) < 0) {
+        perror("Could not install the dirty page tracking handler");
+        exit(-1);
+    }
+#endif
+
+    m_handlerInstalled = true;
+}
+
+void DirtyPageTracker::addRegion(uintptr_t start, uintptr_t size)
+{
+    assert((start & (m_pageSize - 1)) == 0);
+    size = (size + m_pageSize - 1) & ~(m_pageSize - 1);
+
+    if (!m_handlerInstalled) {
+        installHandler();
+    }
+
+    Region r;
+    r.start = start;
+    r.size = size;
+    r.dirty = new uint8_t[size / m_pageSize];
+    memset(r.dirty, 1, size / m_pageSize);
+
+    //The dirty list must never reallocate while pages are protected,
+    //so size it for the worst case right away.
+    uint64_t count = m_dirtyCount;
+    m_dirtyList.resize(m_dirtyList.size() + size / m_pageSize);
+    for (uintptr_t page = start; page < start + size; page += m_pageSize) {
+        m_dirtyList[count++] = page;
+    }
+    m_dirtyCount = count;
+
+    m_regions.push_back(r);
+}
+
+bool DirtyPageTracker::isTracked(uintptr_t address) const
+{
+    for (const Region &r : m_regions) {
+        if (address >= r.start && address < r.start + r.size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool DirtyPageTracker::markDirty(uintptr_t address)
+{
+    for (const Region &r : m_regions) {
+        if (address < r.start || address >= r.start + r.size) {
+            continue;
+        }
+
+        uintptr_t index = (address - r.start) / m_pageSize;
+        uintptr_t page = r.start + index * m_pageSize;
+
+        //Another thread may fault on the same page concurrently
+        lock();
+        if (!r.dirty[index]) {
+            r.dirty[index] = 1;
+            m_dirtyList[m_dirtyCount++] = page;
+        }
+
+#ifndef _WIN32
+        mprotect((void*) page, m_pageSize, PROT_READ | PROT_WRITE);
+#endif
+        unlock();
+        return true;
+    }
+
+    return false;
+}
+
+void DirtyPageTracker::collectDirtyPages(std::vector<uintptr_t> &pages)
+{
+    lock();
+
+    uint64_t count = m_dirtyCount;
+    pages.insert(pages.end(), m_dirtyList.begin(), m_dirtyList.begin() + count);
+
+#ifndef _WIN32
+    //Protect the pages before marking them clean: a write that lands
+    //in between faults, finds the page clean and records it again.
+    //Adjacent pages are coalesced to keep the number of system calls low.
+    uint64_t i = 0;
+    while (i < count) {
+        uintptr_t start = m_dirtyList[i];
+        uintptr_t end = start + m_pageSize;
+        ++i;
+        while (i < count && m_dirtyList[i] == end) {
+            end += m_pageSize;
+            ++i;
+        }
+
+        mprotect((void*) start, end - start, PROT_READ);
+    }
+
+    for (i = 0; i < count; ++i) {
+        uintptr_t page = m_dirtyList[i];
+        for (const Region &r : m_regions) {
+            if (page >= r.start && page < r.start + r.size) {
+                r.dirty[(page - r.start) / m_pageSize] = 0;
+                break;
+            }
+        }
+    }
+
+    m_dirtyCount = 0;
+#endif
+
+    unlock();
+}
+
+void DirtyPageTracker::unprotectAll()
+{
+#ifndef _WIN32
+    for (const Region &r : m_regions) {
+        mprotect((void*) r.start, r.size, PROT_READ | PROT_WRITE);
+    }
+#endif
+}
+
+void DirtyPageTracker::protectAll()
+{
+#ifndef _WIN32
+    //Pages that are still dirty fault once more, which is harmless
+    for (const Region &r : m_regions) {
+        mprotect((void*) r.start, r.size, PROT_READ);
+    }
+#endif
+}
+
+#ifndef _WIN32
+void DirtyPageTracker::segvHandler(int sig, siginfo_t *info, void *context)
+{
+    DirtyPageTracker *t = s_instance;
+    if (!t) {
+        signal(SIGSEGV, SIG_DFL);
+        return;
+    }
+
+    if (t->markDirty((uintptr_t) info->si_addr)) {
+        return;
+    }
+
+    //Not a tracked page, let the previous handler deal with the fault
+    const struct sigaction &old = t->m_oldAction;
+    if (old.sa_flags & SA_SIGINFO) {
+        old.sa_sigaction(sig, info, context);
+    } else if (old.sa_handler != SIG_DFL && old.sa_handler != SIG_IGN) {
+        old.sa_handler(sig);
+    } else {
+        //Returning re-executes the faulting access, which now crashes
+        signal(SIGSEGV, SIG_DFL);
+    }
+}
+#endif
+
+}
@@ -55,12 +55,12 @@ void Plugin::initialize()
 
 PluginState *Plugin::getPluginState(S2EExecutionState *s, PluginStateFactory f) const
 {
-    if (m_CachedPluginS2EState == s) {
-        return m_CachedPluginState;
-    }
-    m_CachedPluginState = s->getPluginState(const_cast<Plugin*>(this), f);
-    m_CachedPluginS2EState = s;
-    return m_CachedPluginState;
+    return s->getPluginState(const_cast<Plugin*>(this), f);
+}
+
+const PluginState *Plugin::getPluginStateConst(S2EExecutionState *s, PluginStateFactory f) const
+{
+    return s->getPluginStateConst(const_cast<Plugin*>(this), f);
 }
 
 PluginsFactory::PluginsFactory()
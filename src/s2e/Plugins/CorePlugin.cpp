@@ -74,6 +74,10 @@ static void s2e_timer_cb(void *opaque)
 
     g_s2e->getExecutor()->updateStats(g_s2e_state);
     c->onTimer.emit();
+
+    //Logging calls only flush when they happen, do not keep output
+    //buffered while the guest is quiet
+    g_s2e->flushOutputStreams();
     qemu_mod_timer(c->getTimer(), qemu_get_clock_ms(rt_clock) + 1000);
 }
 
@@ -90,6 +94,24 @@ void CorePlugin::initialize()
 
 }
 
+void CorePlugin::flushMemoryAccesses(S2EExecutionState *state)
+{
+    MemoryAccessBuffer &accesses = state->getMemoryAccessBuffer();
+    if(accesses.empty()) {
+        return;
+    }
+
+    //Detach the batch before delivering it, a subscriber may throw
+    //CpuExitException and the accesses must not be delivered twice.
+    //Accesses recorded while nobody is subscribed anymore are dropped.
+    m_memoryAccessBatch.clear();
+    m_memoryAccessBatch.swap(accesses);
+    if(!onDataMemoryAccessBatch.empty()) {
+        onDataMemoryAccessBatch.emit(state, m_memoryAccessBatch);
+    }
+    m_memoryAccessBatch.clear();
+}
+
 /******************************/
 /* Functions called from QEMU */
 
@@ -186,15 +208,15 @@ void s2e_on_translate_block_start(
 {
     assert(state->isActive());
 
-    ExecutionSignal *signal = static_cast<ExecutionSignal*>(
-                                    tb->s2e_tb->executionSignals.back());
+    ExecutionSignal *signal = tb->s2e_tb->executionSignals.back();
     assert(signal->empty());
 
     try {
         s2e->getCorePlugin()->onTranslateBlockStart.emit(signal, state, tb, pc);
         if(!signal->empty()) {
             s2e_tcg_instrument_code(s2e, signal, pc);
-            tb->s2e_tb->executionSignals.push_back(new ExecutionSignal);
+            tb->s2e_tb->executionSignals.push_back(
+                    s2e->getExecutor()->getExecutionSignalPool().allocate());
         }
     } catch(s2e::CpuExitException&) {
         s2e_longjmp(env->jmp_env, 1);
@@ -208,8 +230,7 @@ void s2e_on_translate_block_end(
 {
     assert(state->isActive());
 
-    ExecutionSignal *signal = static_cast<ExecutionSignal*>(
-                                    tb->s2e_tb->executionSignals.back());
+    ExecutionSignal *signal = tb->s2e_tb->executionSignals.back();
     assert(signal->empty());
 
     try {
@@ -222,7 +243,8 @@ void s2e_on_translate_block_end(
 
     if(!signal->empty()) {
         s2e_tcg_instrument_code(s2e, signal, insPc);
-        tb->s2e_tb->executionSignals.push_back(new ExecutionSignal);
+        tb->s2e_tb->executionSignals.push_back(
+                s2e->getExecutor()->getExecutionSignalPool().allocate());
     }
 }
 
@@ -232,15 +254,15 @@ void s2e_on_translate_instruction_start(
 {
     assert(state->isActive());
 
-    ExecutionSignal *signal = static_cast<ExecutionSignal*>(
-                                    tb->s2e_tb->executionSignals.back());
+    ExecutionSignal *signal = tb->s2e_tb->executionSignals.back();
     assert(signal->empty());
 
     try {
         s2e->getCorePlugin()->onTranslateInstructionStart.emit(signal, state, tb, pc);
         if(!signal->empty()) {
             s2e_tcg_instrument_code(s2e, signal, pc);
-            tb->s2e_tb->executionSignals.push_back(new ExecutionSignal);
+            tb->s2e_tb->executionSignals.push_back(
+                    s2e->getExecutor()->getExecutionSignalPool().allocate());
         }
     } catch(s2e::CpuExitException&) {
         s2e_longjmp(env->jmp_env, 1);
@@ -253,8 +275,7 @@ void s2e_on_translate_jump_start(
 {
     assert(state->isActive());
 
-    ExecutionSignal *signal = static_cast<ExecutionSignal*>(
-                                    tb->s2e_tb->executionSignals.back());
+    ExecutionSignal *signal = tb->s2e_tb->executionSignals.back();
     assert(signal->empty());
 
     try {
@@ -262,7 +283,8 @@ void s2e_on_translate_jump_start(
                                                         pc, jump_type);
         if(!signal->empty()) {
             s2e_tcg_instrument_code(s2e, signal, pc);
-            tb->s2e_tb->executionSignals.push_back(new ExecutionSignal);
+            tb->s2e_tb->executionSignals.push_back(
+                    s2e->getExecutor()->getExecutionSignalPool().allocate());
         }
     } catch(s2e::CpuExitException&) {
         s2e_longjmp(env->jmp_env, 1);
@@ -277,15 +299,15 @@ void s2e_on_translate_instruction_end(
 {
     assert(state->isActive());
 
-    ExecutionSignal *signal = static_cast<ExecutionSignal*>(
-                                    tb->s2e_tb->executionSignals.back());
+    ExecutionSignal *signal = tb->s2e_tb->executionSignals.back();
     assert(signal->empty());
 
     try {
         s2e->getCorePlugin()->onTranslateInstructionEnd.emit(signal, state, tb, pc);
         if(!signal->empty()) {
             s2e_tcg_instrument_code(s2e, signal, pc, nextpc);
-            tb->s2e_tb->executionSignals.push_back(new ExecutionSignal);
+            tb->s2e_tb->executionSignals.push_back(
+                    s2e->getExecutor()->getExecutionSignalPool().allocate());
         }
     } catch(s2e::CpuExitException&) {
         s2e_longjmp(env->jmp_env, 1);
@@ -298,8 +320,7 @@ void s2e_on_translate_register_access(
 {
     assert(g_s2e_state->isActive());
 
-    ExecutionSignal *signal = static_cast<ExecutionSignal*>(
-                                    tb->s2e_tb->executionSignals.back());
+    ExecutionSignal *signal = tb->s2e_tb->executionSignals.back();
     assert(signal->empty());
 
     try {
@@ -308,7 +329,8 @@ void s2e_on_translate_register_access(
 
         if(!signal->empty()) {
             s2e_tcg_instrument_code(g_s2e, signal, pc);
-            tb->s2e_tb->executionSignals.push_back(new ExecutionSignal);
+            tb->s2e_tb->executionSignals.push_back(
+                    g_s2e->getExecutor()->getExecutionSignalPool().allocate());
         }
     } catch(s2e::CpuExitException&) {
         s2e_longjmp(env->jmp_env, 1);
@@ -342,16 +364,31 @@ static void s2e_trace_memory_access_slow(
         uint64_t vaddr, uint64_t haddr, uint8_t* buf, unsigned size,
         int isWrite, int isIO, int isCode)
 {
+    CorePlugin *core = g_s2e->getCorePlugin();
     uint64_t value = 0;
     unsigned copy_size = (size > sizeof value) ? sizeof (value) : size;
     memcpy(&value, buf, copy_size);
 
     try {
-        g_s2e->getCorePlugin()->onDataMemoryAccess.emit(g_s2e_state,
-            klee::ConstantExpr::create(vaddr, 64),
-            klee::ConstantExpr::create(haddr, 64),
-            klee::ConstantExpr::create(value, copy_size << 3),
-            isWrite, isIO, isCode);
+        if(!core->onDataMemoryAccessBatch.empty()) {
+            MemoryAccessBuffer &accesses = g_s2e_state->getMemoryAccessBuffer();
+            if(accesses.full()) {
+                core->flushMemoryAccesses(g_s2e_state);
+            }
+
+            unsigned flags = (isWrite ? MEM_TRACE_WRITE : 0) |
+                             (isIO ? MEM_TRACE_IO : 0) |
+                             (isCode ? MEM_TRACE_CODE : 0);
+            accesses.append(vaddr, haddr, value, copy_size, flags);
+        }
+
+        if(!core->onDataMemoryAccess.empty()) {
+            core->onDataMemoryAccess.emit(g_s2e_state,
+                klee::ConstantExpr::create(vaddr, 64),
+                klee::ConstantExpr::create(haddr, 64),
+                klee::ConstantExpr::create(value, copy_size << 3),
+                isWrite, isIO, isCode);
+        }
     } catch(s2e::CpuExitException&) {
         s2e_longjmp(env->jmp_env, 1);
     }
@@ -465,7 +502,8 @@ void s2e_trace_memory_access(
         uint64_t vaddr, uint64_t haddr, uint8_t* buf, unsigned size,
         int isWrite, int isIO, int isCode)
 {
-    if(unlikely(!g_s2e->getCorePlugin()->onDataMemoryAccess.empty())) {
+    if(unlikely(!g_s2e->getCorePlugin()->onDataMemoryAccess.empty() ||
+                 !g_s2e->getCorePlugin()->onDataMemoryAccessBatch.empty())) {
         s2e_trace_memory_access_slow(vaddr, haddr, buf, size, isWrite, isIO, isCode);
     }
 }
@@ -578,6 +616,8 @@ void s2e_on_page_directory_change(uint64_t previous, uint64_t current)
 {
     assert(g_s2e_state->isActive());
 
+    g_s2e_state->flushTranslationCache();
+
     try {
         g_s2e->getCorePlugin()->onPageDirectoryChange.emit(g_s2e_state, previous, current);
     } catch(s2e::CpuExitException&) {
@@ -0,0 +1,218 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+extern "C" {
+#include <qemu-common.h>
+}
+
+#include <s2e/Plugins/ExecutionTracer.h>
+#include <s2e/S2E.h>
+#include <s2e/ConfigFile.h>
+#include <s2e/S2EExecutionState.h>
+
+#include <llvm/Support/TimeValue.h>
+
+namespace s2e {
+
+S2E_DEFINE_PLUGIN(ExecutionTracer, "Writes execution events to a binary trace file", "",);
+
+static uint64_t getTraceTimestamp()
+{
+    llvm::sys::TimeValue now = llvm::sys::TimeValue::now();
+    return now.seconds() * 1000000 + now.microseconds();
+}
+
+static uint32_t getTraceStateId(S2EExecutionState *state)
+{
+    return state ? state->getID() : (uint32_t) -1;
+}
+
+ExecutionTracer::ExecutionTracer(S2E* s2e): Plugin(s2e)
+{
+    m_file = NULL;
+    m_chunkUsed = 0;
+    m_testCaseCount = 0;
+}
+
+ExecutionTracer::~ExecutionTracer()
+{
+    if (m_file) {
+        flushChunk();
+        fclose(m_file);
+    }
+}
+
+void ExecutionTracer::initialize()
+{
+    m_fileName = s2e()->getConfig()->getString(getConfigKey() + ".fileName",
+                                               "ExecutionTracer.dat");
+    m_chunk.resize(S2E_TRACE_CHUNK_RECORDS);
+
+    if (!openTraceFile()) {
+        return;
+    }
+
+    CorePlugin *core = s2e()->getCorePlugin();
+    core->onStateFork.connect(
+            sigc::mem_fun(*this, &ExecutionTracer::onStateFork));
+    core->onStateSwitch.connect(
+            sigc::mem_fun(*this, &ExecutionTracer::onStateSwitch));
+    core->onStateKill.connect(
+            sigc::mem_fun(*this, &ExecutionTracer::onStateKill));
+    core->onTestCaseGeneration.connect(
+            sigc::mem_fun(*this, &ExecutionTracer::onTestCaseGeneration));
+    core->onProcessFork.connect(
+            sigc::mem_fun(*this, &ExecutionTracer::onProcessFork));
+    core->onTimer.connect(
+            sigc::mem_fun(*this, &ExecutionTracer::onTimer));
+}
+
+/** Returns false and leaves tracing disabled if the file cannot be written */
+bool ExecutionTracer::openTraceFile()
+{
+    std::string path = s2e()->getOutputFilename(m_fileName);
+    m_file = fopen(path.c_str(), "wb");
+    if (!m_file) {
+        s2e()->getWarningsStream() << "ExecutionTracer: could not open " << path
+                                   << ", tracing disabled\n";
+        return false;
+    }
+
+    //Records are already written in whole chunks
+    setvbuf(m_file, NULL, _IONBF, 0);
+
+    ExecutionTraceHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, S2E_TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.version = S2E_TRACE_VERSION;
+    hdr.recordSize = sizeof(ExecutionTraceRecord);
+    hdr.processIndex = s2e()->getCurrentProcessIndex();
+    hdr.startTime = getTraceTimestamp();
+
+    if (fwrite(&hdr, sizeof(hdr), 1, m_file) != 1) {
+        s2e()->getWarningsStream() << "ExecutionTracer: could not write " << path
+                                   << ", tracing disabled\n";
+        fclose(m_file);
+        m_file = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+void ExecutionTracer::flushChunk()
+{
+    if (!m_file || !m_chunkUsed) {
+        return;
+    }
+
+    if (fwrite(&m_chunk[0], sizeof(ExecutionTraceRecord), m_chunkUsed, m_file) != m_chunkUsed) {
+        s2e()->getWarningsStream() << "ExecutionTracer: could not write trace records\n";
+    }
+    m_chunkUsed = 0;
+}
+
+void ExecutionTracer::writeRecord(S2EExecutionState *state, ExecutionTraceRecordType type,
+                                  uint32_t arg0, uint64_t arg1)
+{
+    if (!m_file) {
+        return;
+    }
+
+    ExecutionTraceRecord &rec = m_chunk[m_chunkUsed];
+    rec.timestamp = getTraceTimestamp();
+    rec.pc = state ? state->getPc() : 0;
+    rec.stateId = getTraceStateId(state);
+    rec.processIndex = s2e()->getCurrentProcessIndex();
+    rec.type = type;
+    rec.reserved = 0;
+    rec.arg0 = arg0;
+    rec.arg1 = arg1;
+
+    if (++m_chunkUsed == S2E_TRACE_CHUNK_RECORDS) {
+        flushChunk();
+    }
+}
+
+void ExecutionTracer::onStateFork(S2EExecutionState *state,
+                                  const std::vector<S2EExecutionState*> &newStates,
+                                  const std::vector<klee::ref<klee::Expr> > &newConditions)
+{
+    for (unsigned i = 0; i < newStates.size(); ++i) {
+        writeRecord(state, TRACE_FORK, getTraceStateId(newStates[i]), i);
+    }
+}
+
+void ExecutionTracer::onStateSwitch(S2EExecutionState *currentState,
+                                    S2EExecutionState *nextState)
+{
+    writeRecord(currentState, TRACE_STATE_SWITCH, getTraceStateId(nextState));
+}
+
+void ExecutionTracer::onStateKill(S2EExecutionState *state)
+{
+    writeRecord(state, TRACE_STATE_KILL);
+}
+
+void ExecutionTracer::onTestCaseGeneration(S2EExecutionState *state, const std::string &message)
+{
+    writeRecord(state, TRACE_TESTCASE, 0, m_testCaseCount++);
+}
+
+void ExecutionTracer::onProcessFork(bool preFork, bool isChild, unsigned parentProcId)
+{
+    if (preFork) {
+        //The child must not inherit buffered records
+        flushChunk();
+        return;
+    }
+
+    if (isChild) {
+        //The child has its own output directory, start a new trace there
+        if (m_file) {
+            fclose(m_file);
+        }
+        m_testCaseCount = 0;
+        openTraceFile();
+    }
+}
+
+void ExecutionTracer::onTimer()
+{
+    flushChunk();
+}
+
+}
@@ -80,6 +80,7 @@ extern CPUArchState *env;
 #include <errno.h>
 
 #include <stdarg.h>
+#include <string.h>
 #include <stdio.h>
 
 #include <sys/stat.h>
@@ -87,6 +88,7 @@ extern CPUArchState *env;
 #ifndef _WIN32
 #include <sys/types.h>
 #include <unistd.h>
+#include <signal.h>
 #endif
 
 // stacktrace.h (c) 2008, Timo Bingmann from http://idlebox.net/
@@ -191,6 +193,39 @@ namespace s2e {
 
 using namespace std;
 
+//The instance whose log files are flushed when the process dies,
+//NULL once its streams are closed
+static const S2E *s_logOwner = NULL;
+
+//klee_error and other exit() paths do not run the S2E destructor
+static void s2e_flush_at_exit()
+{
+    if (s_logOwner) {
+        s_logOwner->flushOutputStreams();
+    }
+}
+
+#ifndef _WIN32
+static const int s_fatalSignals[] = { SIGABRT, SIGSEGV, SIGBUS };
+static const unsigned s_fatalSignalCount = sizeof(s_fatalSignals) / sizeof(s_fatalSignals[0]);
+static struct sigaction s_oldFatalActions[s_fatalSignalCount];
+
+//Failed assertions and crashes must not lose the buffered end of the logs.
+//Flushing is not async-signal safe, but the process is going down anyway.
+static void s2e_fatal_signal_handler(int signal)
+{
+    s2e_flush_at_exit();
+
+    //Let the previous action, by default a core dump, handle the signal
+    for (unsigned i = 0; i < s_fatalSignalCount; ++i) {
+        if (s_fatalSignals[i] == signal) {
+            sigaction(signal, &s_oldFatalActions[i], NULL);
+        }
+    }
+    raise(signal);
+}
+#endif
+
 
 S2E::S2E(int argc, char** argv, TCGLLVMContext *tcgLLVMContext,
     const std::string &configFileName, const std::string &outputDirectory,
@@ -216,6 +251,7 @@ S2E::S2E(int argc, char** argv, TCGLLVMContext *tcgLLVMContext,
 #endif
 
     m_startTimeSeconds = llvm::sys::TimeValue::now().seconds();
+    m_lastFlushSeconds = m_startTimeSeconds;
 
     m_forking = false;
 
@@ -234,6 +270,19 @@ S2E::S2E(int argc, char** argv, TCGLLVMContext *tcgLLVMContext,
        other init* functions can use it. */
     initOutputDirectory(outputDirectory, verbose, false);
 
+    s_logOwner = this;
+    atexit(s2e_flush_at_exit);
+
+#ifndef _WIN32
+    struct sigaction fatalAction;
+    memset(&fatalAction, 0, sizeof(fatalAction));
+    fatalAction.sa_handler = s2e_fatal_signal_handler;
+    sigemptyset(&fatalAction.sa_mask);
+    for (unsigned i = 0; i < s_fatalSignalCount; ++i) {
+        sigaction(s_fatalSignals[i], &fatalAction, &s_oldFatalActions[i]);
+    }
+#endif
+
     /* Copy the config file into the output directory */
     {
         llvm::raw_ostream *out = openOutputFile("s2e.config.lua");
@@ -292,15 +341,16 @@ S2E::~S2E()
         delete p;
     }
 
-    //Tell other instances we are dead so they can fork more
-    S2EShared *shared = m_sync.acquire();
+    //Tell other instances we are dead so they can fork more.
+    //The slot must be freed before the count is decremented,
+    //so that a forking instance always finds a free slot.
+    S2EShared *shared = m_sync.get();
 
     assert(shared->processIds[m_currentProcessId] == m_currentProcessIndex);
-    shared->processIds[m_currentProcessId] = (unsigned) -1;
-    shared->processPids[m_currentProcessId] = (unsigned) -1;
-    --shared->currentProcessCount;
-
-    m_sync.release();
+    AtomicFunctions::write(&shared->processPids[m_currentProcessId], (unsigned) -1);
+    AtomicFunctions::write(&shared->processStateCounts[m_currentProcessId], 0);
+    AtomicFunctions::write(&shared->processIds[m_currentProcessId], (unsigned) -1);
+    AtomicFunctions::fetchAndSub(&shared->currentProcessCount, 1);
 
     delete m_pluginsFactory;
     writeBitCodeToFile();
@@ -327,6 +377,7 @@ S2E::~S2E()
     delete m_warningStream;
     delete m_messageStream;
 
+    s_logOwner = NULL;
     delete m_infoFileRaw;
     delete m_warningsFileRaw;
     delete m_messagesFileRaw;
@@ -511,6 +562,7 @@ void S2E::initPlugins()
             m_pluginsFactory->createPlugin(this, "CorePlugin"));
     assert(m_corePlugin);
 
+    m_corePlugin->setIndex(m_activePluginsList.size());
     m_activePluginsList.push_back(m_corePlugin);
     m_activePluginsMap.insert(
             make_pair(m_corePlugin->getPluginInfo()->name, m_corePlugin));
@@ -545,6 +597,7 @@ void S2E::initPlugins()
             Plugin* plugin = m_pluginsFactory->createPlugin(this, pluginName);
             assert(plugin);
 
+            plugin->setIndex(m_activePluginsList.size());
             m_activePluginsList.push_back(plugin);
             m_activePluginsMap.insert(
                     make_pair(plugin->getPluginInfo()->name, plugin));
@@ -579,17 +632,33 @@ void S2E::initExecutor()
     m_s2eExecutor = new S2EExecutor(this, m_tcgLLVMContext, IOpts, m_s2eHandler);
 }
 
-llvm::raw_ostream& S2E::getStream(llvm::raw_ostream &stream,
-                             const S2EExecutionState* state) const
+void S2E::flushOutputStreams() const
 {
     fflush(stdout);
     fflush(stderr);
 
-    stream.flush();
+    m_infoFileRaw->flush();
+    m_debugFileRaw->flush();
+    m_messagesFileRaw->flush();
+    m_warningsFileRaw->flush();
+    llvm::outs().flush();
+}
+
+//Log files are written through their own buffers. They are flushed
+//at most once per second here and by the CorePlugin timer, instead of
+//on every call, which used to cost several write syscalls per logged
+//line. Exit paths and fatal signals flush them too.
+llvm::raw_ostream& S2E::getStream(llvm::raw_ostream &stream,
+                             const S2EExecutionState* state) const
+{
+    uint64_t seconds = llvm::sys::TimeValue::now().seconds();
+    if (seconds != m_lastFlushSeconds) {
+        m_lastFlushSeconds = seconds;
+        flushOutputStreams();
+    }
 
     if(state) {
-        llvm::sys::TimeValue curTime = llvm::sys::TimeValue::now();
-        stream << (curTime.seconds() - m_startTimeSeconds) << ' ';
+        stream << (seconds - m_startTimeSeconds) << ' ';
 
         if (m_maxProcesses > 1) {
             stream  << "[Node " << m_currentProcessIndex <<
@@ -611,58 +680,56 @@ void S2E::printf(llvm::raw_ostream &os, const char *fmt, ...)
     os << str;
 }
 
-void S2E::refreshPlugins()
-{
-    for( Plugin *plg : m_activePluginsList ) {
-        plg->refresh();
-    }
-}
-
 int S2E::fork()
 {
 #ifdef CONFIG_WIN32
     return -1;
 #else
 
-    S2EShared *shared = m_sync.acquire();
-    if (shared->currentProcessCount == m_maxProcesses) {
-        m_sync.release();
-        return -1;
+    //Reserve a process slot without taking the lock
+    S2EShared *shared = m_sync.get();
+    unsigned count = AtomicFunctions::read(&shared->currentProcessCount);
+    for (;;) {
+        if (count >= m_maxProcesses) {
+            return -1;
+        }
+
+        unsigned prev = AtomicFunctions::compareAndSwap(&shared->currentProcessCount,
+                                                        count, count + 1);
+        if (prev == count) {
+            break;
+        }
+        count = prev;
     }
 
-    unsigned newProcessIndex = shared->lastFileId;
-    ++shared->lastFileId;
-    ++shared->currentProcessCount;
+    unsigned newProcessIndex = AtomicFunctions::fetchAndAdd(&shared->lastFileId, 1);
 
-    m_sync.release();
+    //The child must not inherit pending output, it would be written twice
+    flushOutputStreams();
 
     pid_t pid = ::fork();
     if (pid < 0) {
         //Fork failed
-
-        shared = m_sync.acquire();
         //Do not decrement lastFileId, as other fork may have
         //succeeded while we were handling the failure.
-
-        --shared->currentProcessCount;
-        m_sync.release();
+        AtomicFunctions::fetchAndSub(&shared->currentProcessCount, 1);
         return -1;
     }
 
     if (pid == 0) {
-        //Allocate a free slot in the instance map
-        shared = m_sync.acquire();
+        //Allocate a free slot in the instance map.
+        //The reserved count guarantees that one is available.
         unsigned i=0;
         for (i=0; i<m_maxProcesses; ++i) {
-            if (shared->processIds[i] == (unsigned)-1) {
-                shared->processIds[i] = newProcessIndex;
-                shared->processPids[i] = getpid();
+            if (AtomicFunctions::compareAndSwap(&shared->processIds[i],
+                                                (unsigned)-1, newProcessIndex) == (unsigned)-1) {
+                AtomicFunctions::write(&shared->processStateCounts[i], 0);
+                AtomicFunctions::write(&shared->processPids[i], getpid());
                 m_currentProcessId = i;
                 break;
             }
         }
         assert (i < m_maxProcesses);
-        m_sync.release();
 
         m_currentProcessIndex = newProcessIndex;
         //We are the child process, setup the log files again
@@ -703,55 +770,82 @@ int S2E::fork()
 
 unsigned S2E::fetchAndIncrementStateId()
 {
-    S2EShared *shared = m_sync.acquire();
-    unsigned ret = shared->lastStateId;
-    ++shared->lastStateId;
-    m_sync.release();
-    return ret;
+    return AtomicFunctions::fetchAndAdd(&m_sync.get()->lastStateId, 1);
 }
+
 unsigned S2E::fetchNextStateId()
 {
-    S2EShared *shared = m_sync.acquire();
-    unsigned ret = shared->lastStateId;
-    m_sync.release();
-    return ret;
+    return AtomicFunctions::read(&m_sync.get()->lastStateId);
 }
 
 unsigned S2E::getCurrentProcessCount()
 {
-    S2EShared *shared = m_sync.acquire();
-    unsigned ret = shared->currentProcessCount;
-    m_sync.release();
-    return ret;
+    return AtomicFunctions::read(&m_sync.get()->currentProcessCount);
 }
 
 unsigned S2E::getProcessIndexForId(unsigned id)
 {
     assert(id < m_maxProcesses);
-    S2EShared *shared = m_sync.acquire();
-    unsigned ret = shared->processIds[id];
-    m_sync.release();
-    return ret;
+    return AtomicFunctions::read(&m_sync.get()->processIds[id]);
+}
+
+void S2E::setCurrentStateCount(unsigned count)
+{
+    AtomicFunctions::write(&m_sync.get()->processStateCounts[m_currentProcessId], count);
+}
+
+unsigned S2E::getStateCount(unsigned id)
+{
+    assert(id < m_maxProcesses);
+    return AtomicFunctions::read(&m_sync.get()->processStateCounts[id]);
+}
+
+bool S2E::isMostLoadedProcess()
+{
+    S2EShared *shared = m_sync.get();
+    unsigned ours = AtomicFunctions::read(&shared->processStateCounts[m_currentProcessId]);
+    for (unsigned i=0; i<m_maxProcesses; ++i) {
+        if (i == m_currentProcessId ||
+            AtomicFunctions::read(&shared->processIds[i]) == (unsigned)-1) {
+            continue;
+        }
+
+        //Ties go to the lowest slot, so that only one instance forks
+        unsigned theirs = AtomicFunctions::read(&shared->processStateCounts[i]);
+        if (theirs > ours || (theirs == ours && i < m_currentProcessId)) {
+            return false;
+        }
+    }
+    return true;
 }
 
 bool S2E::checkDeadProcesses()
 {
+    //Reclaiming slots is a structural change, serialize it
+    //with the other instances doing the same.
     S2EShared *shared = m_sync.acquire();
     bool ret = false;
     for (unsigned i=0; i<m_maxProcesses; ++i) {
-        if (shared->processPids[i] == (unsigned)-1) {
+        unsigned pid = AtomicFunctions::read(&shared->processPids[i]);
+        if (pid == (unsigned)-1) {
             continue;
         }
 
         //Check if pid is alive
         char buffer[64];
-        snprintf(buffer, sizeof(buffer), "kill -0 %d", shared->processPids[i]);
-        int ret = system(buffer);
-        if (ret != 0) {
-            //Process is dead, we have to decrement everything
-            shared->processIds[i] = (unsigned) -1;
-            shared->processPids[i] = (unsigned) -1;
-            --shared->currentProcessCount;
+        snprintf(buffer, sizeof(buffer), "kill -0 %d", pid);
+        int status = system(buffer);
+        if (status != 0) {
+            //Process is dead, we have to decrement everything.
+            //The pid goes first so that a new instance
+            //claiming the slot cannot be cleared by mistake.
+            if (AtomicFunctions::compareAndSwap(&shared->processPids[i],
+                                                pid, (unsigned) -1) != pid) {
+                continue;
+            }
+            AtomicFunctions::write(&shared->processStateCounts[i], 0);
+            AtomicFunctions::write(&shared->processIds[i], (unsigned) -1);
+            AtomicFunctions::fetchAndSub(&shared->currentProcessCount, 1);
             ret = true;
         }
     }
@@ -82,6 +82,7 @@ llvm::SmallVector<struct BlockDriverState*, 5> S2EDeviceState::s_blockDevices;
 uint8_t *S2EDeviceState::s_tempStateBuffer = NULL;
 unsigned S2EDeviceState::s_tempStateSize = 0;
 unsigned S2EDeviceState::s_finalStateSize = 0;
+uint64_t S2EDeviceState::s_snapshotBytes = 0;
 
 bool S2EDeviceState::s_devicesInited=false;
 
@@ -114,6 +115,7 @@ S2EDeviceState::S2EDeviceState(const S2EDeviceState &state)
 
     m_stateBuffer = new uint8_t[s_finalStateSize];
     assert(m_stateBuffer);
+    s_snapshotBytes += s_finalStateSize;
     m_fileOps = new QEMUFileOps;
     assert(m_fileOps);
 
@@ -136,6 +138,7 @@ S2EDeviceState::~S2EDeviceState()
 {
     if (m_stateBuffer) {
         free(m_stateBuffer);
+        s_snapshotBytes -= s_finalStateSize;
     }
 
     if (m_memFile)  {
@@ -228,6 +231,7 @@ void S2EDeviceState::initFirstSnapshot()
 
     memcpy(m_stateBuffer, s_tempStateBuffer, s_tempStateSize);
     s_finalStateSize = s_tempStateSize;
+    s_snapshotBytes += s_finalStateSize;
     free(s_tempStateBuffer);
     s_tempStateBuffer = NULL;
     s_tempStateSize = 0;
@@ -113,8 +113,10 @@ S2EExecutionState::S2EExecutionState(klee::KFunction *kf) :
         klee::ExecutionState(kf), m_stateID(g_s2e->fetchAndIncrementStateId()),
         m_symbexEnabled(true), m_startSymbexAtPC((uint64_t) -1),
         m_active(true), m_zombie(false), m_yielded(false), m_runningConcrete(true),
+        m_symbolicRegistersMask(0), m_symbolicRegistersMaskValid(false),
         m_cpuRegistersObject(NULL), m_cpuSystemObject(NULL),
         m_deviceState(this),
+        m_translationCacheGeneration(1),
         m_qemuIcount(0),
         m_lastS2ETb(NULL),
         m_lastMergeICount((uint64_t)-1),
@@ -130,20 +132,19 @@ S2EExecutionState::~S2EExecutionState()
 {
     assert(m_lastS2ETb == NULL);
 
-    PluginStateMap::iterator it;
-
     if (VerboseStateDeletion) {
         g_s2e->getDebugStream() << "Deleting state " << m_stateID << " " << this << '\n';
     }
 
     //print_stacktrace();
 
-    for(it = m_PluginState.begin(); it != m_PluginState.end(); ++it) {
-        delete it->second;
+    for(unsigned i = 0; i < m_PluginState.size(); ++i) {
+        PluginState *plgState = m_PluginState[i];
+        if (plgState && --plgState->m_refCount == 0) {
+            delete plgState;
+        }
     }
 
-    g_s2e->refreshPlugins();
-
     //XXX: This cannot be done, as device states may refer to each other
     //delete m_deviceState;
 
@@ -287,6 +288,7 @@ void S2EExecutionState::addressSpaceChange(const klee::MemoryObject *mo,
         //is left with stale references to memory objects. We patch these
         //objects here.
         m_cpuRegistersObject = newState;
+        invalidateSymbolicRegistersMask();
     } else if (mo == m_cpuSystemState) {
         m_cpuSystemObject = newState;
     } else {
@@ -340,10 +342,16 @@ ExecutionState* S2EExecutionState::clone()
     assert(false && "J stubbed");
 
     // Clone the plugins
-    PluginStateMap::iterator it;
-    ret->m_PluginState.clear();
-    for(it = m_PluginState.begin(); it != m_PluginState.end(); ++it) {
-        ret->m_PluginState.insert(std::make_pair((*it).first, (*it).second->clone()));
+    for(unsigned i = 0; i < m_PluginState.size(); ++i) {
+        PluginState *plgState = m_PluginState[i];
+        if (!plgState) {
+            continue;
+        }
+        if (plgState->isCopyOnWrite()) {
+            ++plgState->m_refCount;
+        } else {
+            ret->m_PluginState[i] = plgState->clone();
+        }
     }
 
     // This objects are not in TLB and won't cause any changes to it
@@ -366,6 +374,18 @@ ExecutionState* S2EExecutionState::clone()
     return ret;
 }
 
+void S2EExecutionState::logRamWrite(const MemoryObject *mo)
+{
+    //The node is shared with a parent or child state after a fork
+    if (!m_ramWriteLog || !m_ramWriteLog.unique()) {
+        std::shared_ptr<RamWriteLog> node(new RamWriteLog);
+        node->depth = m_ramWriteLog ? m_ramWriteLog->depth + 1 : 0;
+        node->parent = m_ramWriteLog;
+        m_ramWriteLog = node;
+    }
+    m_ramWriteLog->objects.insert(mo);
+}
+
 ref<Expr> S2EExecutionState::readCpuRegister(unsigned offset,
                                              Expr::Width width) const
 {
@@ -393,6 +413,7 @@ void S2EExecutionState::writeCpuRegister(unsigned offset,
 
     if(!m_runningConcrete || !m_cpuRegistersObject->isConcrete(offset, width)) {
         m_cpuRegistersObject->write(offset, value);
+        invalidateSymbolicRegistersMask();
 
     } else {
         /* XXX: should we check getSymbolicRegisterMask ? */
@@ -415,6 +436,7 @@ void S2EExecutionState::writeCpuRegisterSymbolic(unsigned offset,
     assert(offset + Expr::getMinBytesForWidth(width) <= CPU_CONC_LIMIT);
 
     m_cpuRegistersObject->write(offset, value);
+    invalidateSymbolicRegistersMask();
 }
 
 bool S2EExecutionState::readCpuRegisterConcrete(unsigned offset,
@@ -527,6 +549,7 @@ void S2EExecutionState::kleeWriteMemory(ref<Expr> kleeAddressExpr, /* Address */
     const ObjectState *os = op.second;
     ObjectState *wos = addressSpace.getWriteable(mo, os);
     assert(bytes.size() <= os->size && "Too many bytes supplied to kleeWriteMemory");
+    logInactiveRamWrite(mo);
 
     // Write an array of possibly-symbolic bytes
     unsigned i;
@@ -873,6 +896,10 @@ uint64_t S2EExecutionState::getSymbolicRegistersMask() const
     if(os->isAllConcrete())
         return 0;
 
+    if (m_runningConcrete && m_symbolicRegistersMaskValid) {
+        return m_symbolicRegistersMask;
+    }
+
     uint64_t mask = 0;
 
 #ifdef TARGET_I386
@@ -942,6 +969,11 @@ uint64_t S2EExecutionState::getSymbolicRegistersMask() const
     assert(false & "Update Hardcoded masking of symbolic fields of CPUArchState for your target.");
 #error "Target architecture not supported"
 #endif
+
+    if (m_runningConcrete) {
+        m_symbolicRegistersMask = mask;
+        m_symbolicRegistersMaskValid = true;
+    }
     return mask;
 }
 
@@ -950,14 +982,24 @@ bool S2EExecutionState::readMemoryConcrete(uint64_t address, void *buf,
 {
     uint8_t *d = (uint8_t*)buf;
     while (size>0) {
-        ref<Expr> v = readMemory(address, Expr::Int8, addressType);
-        if (v.isNull() || !isa<ConstantExpr>(v)) {
+        //Translate once per guest page
+        uint64_t length = TARGET_PAGE_SIZE - (address & ~TARGET_PAGE_MASK);
+        if (length > size) {
+            length = size;
+        }
+
+        uint64_t hostAddress = getHostAddress(address, addressType);
+        if (hostAddress == (uint64_t) -1) {
             return false;
         }
-        *d = (uint8_t)cast<ConstantExpr>(v)->getZExtValue(8);
-        size--;
-        d++;
-        address++;
+
+        if (!readRamConcreteRun(hostAddress, d, length)) {
+            return false;
+        }
+
+        size -= length;
+        d += length;
+        address += length;
     }
     return true;
 }
@@ -965,29 +1007,134 @@ bool S2EExecutionState::readMemoryConcrete(uint64_t address, void *buf,
 bool S2EExecutionState::writeMemoryConcrete(uint64_t address, void *buf,
                                    uint64_t size, AddressType addressType)
 {
-    uint8_t *d = (uint8_t*)buf;
+    const uint8_t *d = (const uint8_t*)buf;
     while (size>0) {
-        klee::ref<klee::ConstantExpr> val = klee::ConstantExpr::create(*d, klee::Expr::Int8);
-        bool b = writeMemory(address, val,  addressType);
-        if (!b) {
+        uint64_t length = TARGET_PAGE_SIZE - (address & ~TARGET_PAGE_MASK);
+        if (length > size) {
+            length = size;
+        }
+
+        uint64_t hostAddress = getHostAddress(address, addressType);
+        if (hostAddress == (uint64_t) -1) {
             return false;
         }
-        size--;
-        d++;
-        address++;
+
+        writeRamConcreteRun(hostAddress, d, length);
+
+        size -= length;
+        d += length;
+        address += length;
     }
     return true;
 }
 
+/** Reads host memory that does not cross a guest page boundary.
+    Fails on the first symbolic byte, without concretizing it. */
+bool S2EExecutionState::readRamConcreteRun(uint64_t hostAddress, uint8_t *buf, uint64_t size)
+{
+    while (size > 0) {
+        uint64_t objectOffset = hostAddress & ~S2E_RAM_OBJECT_MASK;
+        uint64_t objectAddress = hostAddress & S2E_RAM_OBJECT_MASK;
+        uint64_t length = S2E_RAM_OBJECT_SIZE - objectOffset;
+        if (length > size) {
+            length = size;
+        }
+
+        ObjectPair op = m_memcache.get(objectAddress);
+        if (!op.first) {
+            op = addressSpace.findObject(objectAddress);
+            m_memcache.put(objectAddress, op);
+        }
+
+        assert(op.first && op.first->isUserSpecified
+               && op.first->size == S2E_RAM_OBJECT_SIZE);
+
+        if (op.first->isSharedConcrete && m_active) {
+            memcpy(buf, (const uint8_t*) op.first->address + objectOffset, length);
+        } else if (!op.first->isSharedConcrete && op.second->isConcrete(objectOffset, length*8)) {
+            memcpy(buf, op.second->getConcreteStore(true) + objectOffset, length);
+        } else {
+            for (uint64_t i = 0; i < length; ++i) {
+                ref<Expr> v = op.second->read8(objectOffset + i);
+                if (!isa<ConstantExpr>(v)) {
+                    return false;
+                }
+                buf[i] = (uint8_t)cast<ConstantExpr>(v)->getZExtValue(8);
+            }
+        }
+
+        size -= length;
+        buf += length;
+        hostAddress += length;
+    }
+    return true;
+}
+
+void S2EExecutionState::writeRamConcreteRun(uint64_t hostAddress, const uint8_t *buf, uint64_t size)
+{
+    while (size > 0) {
+        uint64_t objectOffset = hostAddress & ~S2E_RAM_OBJECT_MASK;
+        uint64_t objectAddress = hostAddress & S2E_RAM_OBJECT_MASK;
+        uint64_t length = S2E_RAM_OBJECT_SIZE - objectOffset;
+        if (length > size) {
+            length = size;
+        }
+
+        ObjectPair op = m_memcache.get(objectAddress);
+        if (!op.first) {
+            op = addressSpace.findObject(objectAddress);
+            m_memcache.put(objectAddress, op);
+        }
+
+        assert(op.first && op.first->isUserSpecified
+               && op.first->size == S2E_RAM_OBJECT_SIZE);
+
+        //Shared concrete data goes straight to the host memory, only
+        //the other cases need a private copy of the ObjectState
+        if (op.first->isSharedConcrete && m_active) {
+            memcpy((uint8_t*) op.first->address + objectOffset, buf, length);
+        } else if (!op.first->isSharedConcrete && op.second->isConcrete(objectOffset, length*8)) {
+            ObjectState *wos = addressSpace.getWriteable(op.first, op.second);
+            memcpy(wos->getConcreteStore(true) + objectOffset, buf, length);
+        } else {
+            ObjectState *wos = addressSpace.getWriteable(op.first, op.second);
+            logInactiveRamWrite(op.first);
+            for (uint64_t i = 0; i < length; ++i) {
+                wos->write8(objectOffset + i, buf[i]);
+            }
+        }
+
+        size -= length;
+        buf += length;
+        hostAddress += length;
+    }
+}
+
 uint64_t S2EExecutionState::getPhysicalAddress(uint64_t virtualAddress) const
 {
     assert(m_active && "Can not use getPhysicalAddress when the state"
                        " is not active (TODO: fix it)");
+
+    uint64_t virtualPage = virtualAddress & TARGET_PAGE_MASK;
+    S2ETranslationCacheEntry &entry = m_translationCache[
+            (virtualAddress >> TARGET_PAGE_BITS) & (S2E_TRANSLATION_CACHE_SIZE - 1)];
+
+    if (entry.generation == m_translationCacheGeneration &&
+        entry.virtualPage == virtualPage) {
+        return entry.physicalPage | (virtualAddress & ~TARGET_PAGE_MASK);
+    }
+
     hwaddr physicalAddress =
-        cpu_get_phys_page_debug(ENV_GET_CPU(env), virtualAddress & TARGET_PAGE_MASK);
+        cpu_get_phys_page_debug(ENV_GET_CPU(env), virtualPage);
     if(physicalAddress == (hwaddr) -1)
         return (uint64_t) -1;
 
+    //Failed walks are not cached, the guest may map the page
+    //without flushing the TLB.
+    entry.virtualPage = virtualPage;
+    entry.physicalPage = physicalAddress;
+    entry.generation = m_translationCacheGeneration;
+
     return physicalAddress | (virtualAddress & ~TARGET_PAGE_MASK);
 }
 
@@ -1173,6 +1320,7 @@ bool S2EExecutionState::writeMemory(uint64_t address,
 
         ObjectState *wos = addressSpace.getWriteable(op.first, op.second);
         wos->write(hostAddress & ~S2E_RAM_OBJECT_MASK, value);
+        logInactiveRamWrite(op.first);
     } else {
         // Slowest case (TODO: could optimize it)
         unsigned numBytes = width / 8;
@@ -1204,6 +1352,7 @@ bool S2EExecutionState::writeMemory8(uint64_t address,
 
     ObjectState *wos = addressSpace.getWriteable(op.first, op.second);
     wos->write(hostAddress & ~S2E_RAM_OBJECT_MASK, value);
+    logInactiveRamWrite(op.first);
     return true;
 }
 
@@ -1229,6 +1378,7 @@ bool S2EExecutionState::writeMemory(uint64_t address,
         ObjectState *wos = addressSpace.getWriteable(op.first, op.second);
         for(uint64_t i = 0; i < width / 8; ++i)
             wos->write8(pageOffset + i, buf[i]);
+        logInactiveRamWrite(op.first);
 
     } else {
         /* Access spawns multiple MemoryObject's */
@@ -1287,6 +1437,17 @@ void S2EExecutionState::readRamConcreteCheck(uint64_t hostAddress, uint8_t* buf,
                op.first->address == page_addr &&
                op.first->size == S2E_RAM_OBJECT_SIZE);
 
+        //Fast path: the whole range is concrete, copy it at once
+        if (op.first->isSharedConcrete) {
+            memcpy(buf, (const uint8_t*) op.first->address + page_offset, size);
+            return;
+        }
+
+        if (op.second->isConcrete(page_offset, size*8)) {
+            memcpy(buf, op.second->getConcreteStore(true) + page_offset, size);
+            return;
+        }
+
         for(uint64_t i=0; i<size; ++i) {
             if(!op.second->readConcrete8(page_offset+i, buf+i)) {
                 if (PrintModeSwitch) {
@@ -1330,6 +1491,17 @@ void S2EExecutionState::readRamConcrete(uint64_t hostAddress, uint8_t* buf, uint
                op.first->address == page_addr &&
                op.first->size == S2E_RAM_OBJECT_SIZE);
 
+        if (op.first->isSharedConcrete) {
+            memcpy(buf, (const uint8_t*) op.first->address + page_offset, size);
+            return;
+        }
+
+        if (op.second->isConcrete(page_offset, size*8)) {
+            memcpy(buf, op.second->getConcreteStore(true) + page_offset, size);
+            return;
+        }
+
+        //Only the symbolic bytes need to be concretized
         ObjectState *wos = NULL;
         for(uint64_t i=0; i<size; ++i) {
             if(!op.second->readConcrete8(page_offset+i, buf+i)) {
@@ -1371,10 +1543,17 @@ void S2EExecutionState::writeRamConcrete(uint64_t hostAddress, const uint8_t* bu
                op.first->address == page_addr &&
                op.first->size == S2E_RAM_OBJECT_SIZE);
 
-        ObjectState* wos =
-                addressSpace.getWriteable(op.first, op.second);
-        for(uint64_t i=0; i<size; ++i) {
-            wos->write8(page_offset+i, buf[i]);
+        if (op.first->isSharedConcrete) {
+            memcpy((uint8_t*) op.first->address + page_offset, buf, size);
+        } else if (op.second->isConcrete(page_offset, size*8)) {
+            //Overwriting concrete bytes does not change the concrete mask
+            ObjectState* wos = addressSpace.getWriteable(op.first, op.second);
+            memcpy(wos->getConcreteStore(true) + page_offset, buf, size);
+        } else {
+            ObjectState* wos = addressSpace.getWriteable(op.first, op.second);
+            for(uint64_t i=0; i<size; ++i) {
+                wos->write8(page_offset+i, buf[i]);
+            }
         }
 
     } else {
@@ -1446,6 +1625,7 @@ void S2EExecutionState::readRegisterConcrete(
                 buf[i] = g_s2e->getExecutor()->toConstant(*this, wos->read8(offset+i),
                                     reason.c_str())->getZExtValue(8);
                 wos->write8(offset+i, buf[i]);
+                invalidateSymbolicRegistersMask();
             }
         }
     } else {
@@ -1473,6 +1653,7 @@ void S2EExecutionState::writeRegisterConcrete(CPUArchState *cpuState,
         ObjectState* wos = m_cpuRegistersObject;
         for(unsigned i = 0; i < size; ++i)
             wos->write8(offset+i, buf[i]);
+        invalidateSymbolicRegistersMask();
     } else {
         assert(m_cpuRegistersObject->isConcrete(offset, size*8));
         small_memcpy(((uint8_t*)cpuState)+offset, buf, size);
@@ -1693,6 +1874,37 @@ void S2EExecutionState::dumpCpuState(llvm::raw_ostream &os) const
 #endif
 }
 
+const char *S2EExecutionState::s_mergeOutcomeNames[MergeOutcomeCount] = {
+    "merged",
+    "different pc",
+    "different callstacks",
+    "different symbolics",
+    "different concrete cpu state",
+    "different address maps",
+    "different shared-concrete objects",
+};
+
+uint64_t S2EExecutionState::s_mergeOutcomes[MergeOutcomeCount];
+
+bool S2EExecutionState::rejectMerge(MergeOutcome reason) const
+{
+    ++s_mergeOutcomes[reason];
+    if(DebugLogStateMerge) {
+        g_s2e->getMessagesStream(this) << "merge failed: "
+                                       << s_mergeOutcomeNames[reason] << '\n';
+    }
+    return false;
+}
+
+void S2EExecutionState::printMergeStatistics(llvm::raw_ostream &os)
+{
+    os << "State merge outcomes:";
+    for (unsigned i = 0; i < MergeOutcomeCount; ++i) {
+        os << " [" << s_mergeOutcomeNames[i] << ": " << s_mergeOutcomes[i] << "]";
+    }
+    os << '\n';
+}
+
 bool S2EExecutionState::merge(const ExecutionState &_b)
 {
     assert(dynamic_cast<const S2EExecutionState*>(&_b));
@@ -1705,68 +1917,31 @@ bool S2EExecutionState::merge(const ExecutionState &_b)
     if(DebugLogStateMerge)
         s << "Attempting merge with state " << b.getID() << '\n';
 
+    //Cheap checks go first, so that most attempts are rejected
+    //before any work on constraints or memory.
     if(pc != b.pc) {
-        if(DebugLogStateMerge)
-            s << "merge failed: different pc" << '\n';
-        return false;
+        return rejectMerge(MergeDifferentPc);
     }
 
-    // XXX is it even possible for these to differ? does it matter? probably
-    // implies difference in object states?
-    if(symbolics != b.symbolics) {
-        if(DebugLogStateMerge)
-            s << "merge failed: different symbolics" << '\n';
-        return false;
+    if(stack.size() != b.stack.size()) {
+        return rejectMerge(MergeDifferentStack);
     }
 
     {
         std::vector<StackFrame>::const_iterator itA = stack.begin();
         std::vector<StackFrame>::const_iterator itB = b.stack.begin();
-        while (itA!=stack.end() && itB!=b.stack.end()) {
+        for (; itA!=stack.end(); ++itA, ++itB) {
             // XXX vaargs?
             if(itA->caller!=itB->caller || itA->kf!=itB->kf) {
-                if(DebugLogStateMerge)
-                    s << "merge failed: different callstacks" << '\n';
+                return rejectMerge(MergeDifferentStack);
             }
-          ++itA;
-          ++itB;
-        }
-        if(itA!=stack.end() || itB!=b.stack.end()) {
-            if(DebugLogStateMerge)
-                s << "merge failed: different callstacks" << '\n';
-            return false;
         }
     }
 
-    std::set< ref<Expr> > aConstraints(constraints.begin(), constraints.end());
-    std::set< ref<Expr> > bConstraints(b.constraints.begin(),
-                                       b.constraints.end());
-    std::set< ref<Expr> > commonConstraints, aSuffix, bSuffix;
-    std::set_intersection(aConstraints.begin(), aConstraints.end(),
-                          bConstraints.begin(), bConstraints.end(),
-                          std::inserter(commonConstraints, commonConstraints.begin()));
-    std::set_difference(aConstraints.begin(), aConstraints.end(),
-                        commonConstraints.begin(), commonConstraints.end(),
-                        std::inserter(aSuffix, aSuffix.end()));
-    std::set_difference(bConstraints.begin(), bConstraints.end(),
-                        commonConstraints.begin(), commonConstraints.end(),
-                        std::inserter(bSuffix, bSuffix.end()));
-    if(DebugLogStateMerge) {
-        s << "\tconstraint prefix: [";
-        for(std::set< ref<Expr> >::iterator it = commonConstraints.begin(),
-                        ie = commonConstraints.end(); it != ie; ++it)
-            s << *it << ", ";
-        s << "]\n";
-        s << "\tA suffix: [";
-        for(std::set< ref<Expr> >::iterator it = aSuffix.begin(),
-                        ie = aSuffix.end(); it != ie; ++it)
-            s << *it << ", ";
-        s << "]\n";
-        s << "\tB suffix: [";
-        for(std::set< ref<Expr> >::iterator it = bSuffix.begin(),
-                        ie = bSuffix.end(); it != ie; ++it)
-        s << *it << ", ";
-        s << "]" << '\n';
+    // XXX is it even possible for these to differ? does it matter? probably
+    // implies difference in object states?
+    if(symbolics != b.symbolics) {
+        return rejectMerge(MergeDifferentSymbolics);
     }
 
     /* Check CPUArchState */
@@ -1777,9 +1952,7 @@ bool S2EExecutionState::merge(const ExecutionState &_b)
         //TODO[J]: stubbed
 //        if(memcmp(cpuStateA + CPU_CONC_LIMIT, cpuStateB + CPU_CONC_LIMIT,
 //                  CPU_OFFSET(current_tb) - CPU_CONC_LIMIT)) {
-//            if(DebugLogStateMerge)
-//                s << "merge failed: different concrete cpu state" << "\n";
-//            return false;
+//            return rejectMerge(MergeDifferentCpuState);
 //        }
         assert(false && "J stubbed");
     }
@@ -1813,9 +1986,7 @@ bool S2EExecutionState::merge(const ExecutionState &_b)
                     s << "\t\tA misses binding for: " << bi->first->id << "\n";
                 }
             }
-            if(DebugLogStateMerge)
-                s << "merge failed: different callstacks" << '\n';
-            return false;
+            return rejectMerge(MergeDifferentAddressMap);
         }
         if(ai->second != bi->second && !ai->first->isValueIgnored &&
                     ai->first != m_cpuSystemState && ai->first != m_dirtyMask) {
@@ -1823,18 +1994,55 @@ bool S2EExecutionState::merge(const ExecutionState &_b)
             if(DebugLogStateMerge)
                 s << "\t\tmutated: " << mo->id << " (" << mo->name << ")\n";
             if(mo->isSharedConcrete) {
-                if(DebugLogStateMerge)
-                    s << "merge failed: different shared-concrete objects "
-                      << '\n';
-                return false;
+                return rejectMerge(MergeSharedConcreteMutated);
             }
             mutated.insert(mo);
         }
     }
     if(ai!=ae || bi!=be) {
-        if(DebugLogStateMerge)
-            s << "merge failed: different address maps" << '\n';
-        return false;
+        return rejectMerge(MergeDifferentAddressMap);
+    }
+
+    // Both states usually descend from a common ancestor, so their
+    // constraint vectors share a prefix. Only the suffixes need set work.
+    std::vector< ref<Expr> > commonConstraints;
+    ConstraintManager::const_iterator ca = constraints.begin();
+    ConstraintManager::const_iterator cb = b.constraints.begin();
+    for(; ca != constraints.end() && cb != b.constraints.end() && *ca == *cb;
+        ++ca, ++cb) {
+        commonConstraints.push_back(*ca);
+    }
+    unsigned prefixLength = commonConstraints.size();
+
+    std::set< ref<Expr> > aConstraints(ca, constraints.end());
+    std::set< ref<Expr> > bConstraints(cb, b.constraints.end());
+    std::set< ref<Expr> > aSuffix, bSuffix;
+    std::set_intersection(aConstraints.begin(), aConstraints.end(),
+                          bConstraints.begin(), bConstraints.end(),
+                          std::back_inserter(commonConstraints));
+    std::set_difference(aConstraints.begin(), aConstraints.end(),
+                        bConstraints.begin(), bConstraints.end(),
+                        std::inserter(aSuffix, aSuffix.end()));
+    std::set_difference(bConstraints.begin(), bConstraints.end(),
+                        aConstraints.begin(), aConstraints.end(),
+                        std::inserter(bSuffix, bSuffix.end()));
+    if(DebugLogStateMerge) {
+        s << "\tshared constraint prefix length: " << prefixLength << "\n";
+        s << "\tconstraint prefix: [";
+        for(std::vector< ref<Expr> >::iterator it = commonConstraints.begin(),
+                        ie = commonConstraints.end(); it != ie; ++it)
+            s << *it << ", ";
+        s << "]\n";
+        s << "\tA suffix: [";
+        for(std::set< ref<Expr> >::iterator it = aSuffix.begin(),
+                        ie = aSuffix.end(); it != ie; ++it)
+            s << *it << ", ";
+        s << "]\n";
+        s << "\tB suffix: [";
+        for(std::set< ref<Expr> >::iterator it = bSuffix.begin(),
+                        ie = bSuffix.end(); it != ie; ++it)
+        s << *it << ", ";
+        s << "]" << '\n';
     }
 
     // Create state predicates
@@ -1902,7 +2110,7 @@ bool S2EExecutionState::merge(const ExecutionState &_b)
         s << "\t\tcreated " << selectCountMem << " select expressions in memory\n";
 
     constraints = ConstraintManager();
-    for(std::set< ref<Expr> >::iterator it = commonConstraints.begin(),
+    for(std::vector< ref<Expr> >::iterator it = commonConstraints.begin(),
                 ie = commonConstraints.end(); it != ie; ++it)
         constraints.addConstraint(*it);
 
@@ -1942,6 +2150,9 @@ bool S2EExecutionState::merge(const ExecutionState &_b)
         assert(false && "J stubbed");
     }
 
+    invalidateSymbolicRegistersMask();
+
+    ++s_mergeOutcomes[MergeSucceeded];
     return true;
 }
 
@@ -2047,10 +2258,20 @@ void S2EExecutionState::flushTlbCache()
     g_s2e->getDebugStream(this) << "Flushing TLB cache\n";
 #endif
     m_tlbMap.clear();
+    flushTranslationCache();
 }
 
 void S2EExecutionState::flushTlbCachePage(klee::ObjectState *objectState, int mmu_idx, int index)
 {
+    //The page may have been remapped (e.g., invlpg). QEMU indexes its TLB
+    //with the low bits of the virtual page number, like the translation
+    //cache, so only the slot of that page is dropped. The address in the
+    //TLB entry is not used, the translation cache is filled by page walks
+    //that do not go through the TLB.
+    static_assert(CPU_TLB_SIZE >= S2E_TRANSLATION_CACHE_SIZE,
+                  "a TLB index must select a single translation cache slot");
+    flushTranslationCachePage(index);
+
     if (!objectState) {
         return;
     }
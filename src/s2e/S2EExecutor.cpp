@@ -44,6 +44,7 @@
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/Constants.h>
+#include <llvm/ADT/SmallPtrSet.h>
 #include <llvm/PassManager.h>
 #include <llvm/IR/DataLayout.h>
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
@@ -104,6 +105,8 @@ uint64_t helper_set_cc_op_eflags(void);
 #include <s2e/S2EDeviceState.h>
 #include <s2e/SelectRemovalPass.h>
 #include <s2e/S2EStatsTracker.h>
+#include <s2e/DirtyPageTracker.h>
+#include <s2e/TBProfiler.h>
 
 //XXX: Remove this from executor
 //#include <s2e/Plugins/ModuleExecutionDetector.h>
@@ -120,6 +123,7 @@ uint64_t helper_set_cc_op_eflags(void);
 #include <klee/Solver.h>
 
 #include <vector>
+#include <algorithm>
 
 #include <sstream>
 
@@ -173,6 +177,47 @@ namespace {
                      " disabling leads to faster but possibly incorrect execution"),
             cl::init(true));
 
+    cl::opt<bool>
+    DirtyTrackedStateSwitch("dirty-tracked-state-switch",
+            cl::desc("Only save and restore RAM pages written since the last state switch."
+                     " Relies on host page protection: system calls that write directly into"
+                     " guest RAM (e.g., direct disk I/O) fail with EFAULT"),
+            cl::init(false));
+
+    cl::opt<unsigned>
+    LoadBalancingFanOut("load-balancing-fan-out",
+            cl::desc("Maximum number of processes to fork in one load balancing round."
+                     " Higher values occupy all available cores faster than repeated halving"),
+            cl::init(1));
+
+    cl::opt<bool>
+    ProfileTranslationBlocks("profile-translation-blocks",
+            cl::desc("Count executions, interpreted instructions, forks and symbolic time"
+                     " per translation block"),
+            cl::init(false));
+
+    cl::opt<unsigned>
+    ProfileTableBits("profile-table-bits",
+            cl::desc("Log2 of the number of translation blocks the profiler can track"),
+            cl::init(16));
+
+    cl::opt<unsigned>
+    ProfileDumpInterval("profile-dump-interval",
+            cl::desc("Write the translation block profile every N seconds (0 = only at exit)"),
+            cl::init(60));
+
+    cl::opt<unsigned>
+    TBOptimizationThreshold("tb-optimization-threshold",
+            cl::desc("Run the function pass manager on translation blocks executed"
+                     " symbolically this many times. 0 disables the optimization"),
+            cl::init(64));
+
+    cl::opt<unsigned>
+    TCGLLVMIdleFunctions("tcg-llvm-idle-functions",
+            cl::desc("Number of unreferenced translation block functions kept"
+                     " for reuse when the same block is translated again"),
+            cl::init(4096));
+
     cl::opt<bool>
     KeepLLVMFunctions("keep-llvm-functions",
             cl::desc("Never delete generated LLVM functions"),
@@ -432,22 +477,50 @@ void S2EExecutor::handlerTraceMemoryAccess(Executor* executor,
     assert(dynamic_cast<S2EExecutor*>(executor));
 
     S2EExecutor* s2eExecutor = static_cast<S2EExecutor*>(executor);
-    if(!s2eExecutor->m_s2e->getCorePlugin()->onDataMemoryAccess.empty()) {
-        assert(dynamic_cast<S2EExecutionState*>(state));
-        S2EExecutionState* s2eState = static_cast<S2EExecutionState*>(state);
+    CorePlugin *core = s2eExecutor->m_s2e->getCorePlugin();
+    bool traceAccess = !core->onDataMemoryAccess.empty();
+    bool traceBatch = !core->onDataMemoryAccessBatch.empty();
+    if(!traceAccess && !traceBatch) {
+        return;
+    }
+
+    assert(dynamic_cast<S2EExecutionState*>(state));
+    S2EExecutionState* s2eState = static_cast<S2EExecutionState*>(state);
 
-        assert(args.size() == 7);
+    assert(args.size() == 7);
 
-        Expr::Width width = cast<klee::ConstantExpr>(args[3])->getZExtValue();
-        bool isWrite = cast<klee::ConstantExpr>(args[4])->getZExtValue();
-        bool isIO    = cast<klee::ConstantExpr>(args[5])->getZExtValue();
-        bool isCode  = cast<klee::ConstantExpr>(args[6])->getZExtValue();
+    Expr::Width width = cast<klee::ConstantExpr>(args[3])->getZExtValue();
+    bool isWrite = cast<klee::ConstantExpr>(args[4])->getZExtValue();
+    bool isIO    = cast<klee::ConstantExpr>(args[5])->getZExtValue();
+    bool isCode  = cast<klee::ConstantExpr>(args[6])->getZExtValue();
 
-        ref<Expr> value = klee::ExtractExpr::create(args[2], 0, width);
+    ref<Expr> value = klee::ExtractExpr::create(args[2], 0, width);
 
-        s2eExecutor->m_s2e->getCorePlugin()->onDataMemoryAccess.emit(
+    if(traceAccess) {
+        core->onDataMemoryAccess.emit(
                 s2eState, args[0], args[1], value, isWrite, isIO, isCode);
     }
+
+    if(traceBatch) {
+        unsigned flags = (isWrite ? MEM_TRACE_WRITE : 0) |
+                         (isIO ? MEM_TRACE_IO : 0) |
+                         (isCode ? MEM_TRACE_CODE : 0);
+
+        MemoryAccessBuffer &accesses = s2eState->getMemoryAccessBuffer();
+        if(accesses.full()) {
+            core->flushMemoryAccesses(s2eState);
+        }
+
+        if(isa<klee::ConstantExpr>(args[0]) && isa<klee::ConstantExpr>(args[1]) &&
+                isa<klee::ConstantExpr>(value)) {
+            accesses.append(cast<klee::ConstantExpr>(args[0])->getZExtValue(),
+                            cast<klee::ConstantExpr>(args[1])->getZExtValue(),
+                            cast<klee::ConstantExpr>(value)->getZExtValue(),
+                            width / 8, flags);
+        } else {
+            accesses.appendSymbolic(args[0], args[1], value, width / 8, flags);
+        }
+    }
 }
 
 void S2EExecutor::handlerHijackMemoryAccess(Executor* executor,
@@ -718,7 +791,8 @@ S2EExecutor::S2EExecutor(S2E* s2e, TCGLLVMContext *tcgLLVMContext,
                     const InterpreterOptions &opts,
                             InterpreterHandler *ie)
         : Executor(opts, ie, tcgLLVMContext->getExecutionEngine()),
-          m_s2e(s2e), m_tcgLLVMContext(tcgLLVMContext),
+          m_s2e(s2e), m_tcgLLVMContext(tcgLLVMContext), m_dirtyPages(NULL),
+          m_hostRamLogValid(false), m_tbProfiler(NULL),
           m_executeAlwaysKlee(false), m_forkProcTerminateCurrentState(false),
           m_inLoadBalancing(false), yieldedState(NULL)
 {
@@ -873,6 +947,8 @@ S2EExecutor::S2EExecutor(S2E* s2e, TCGLLVMContext *tcgLLVMContext,
     }
 #endif
 
+    m_tcgLLVMContext->setMaxIdleFunctions(TCGLLVMIdleFunctions);
+
     if(UseSelectCleaner) {
         m_tcgLLVMContext->getFunctionPassManager()->add(new SelectRemovalPass());
         m_tcgLLVMContext->getFunctionPassManager()->doInitialization();
@@ -1002,6 +1078,9 @@ S2EExecutor::S2EExecutor(S2E* s2e, TCGLLVMContext *tcgLLVMContext,
 
     initializeStatistics();
 
+    if (ProfileTranslationBlocks) {
+        m_tbProfiler = new TBProfiler(s2e, ProfileTableBits, ProfileDumpInterval);
+    }
 
     searcher = constructUserSearcher(*this);
 
@@ -1022,6 +1101,12 @@ S2EExecutor::S2EExecutor(S2E* s2e, TCGLLVMContext *tcgLLVMContext,
         }
     }
 
+    if (TBOptimizationThreshold == 1) {
+        s2e->getWarningsStream()
+                << TBOptimizationThreshold.ArgStr << "=1 optimizes every block before"
+                << " its first symbolic run and keeps two functions per block,"
+                << " use 0 to disable the optimization\n";
+    }
 }
 
 void S2EExecutor::initializeStatistics()
@@ -1044,6 +1129,17 @@ S2EExecutor::~S2EExecutor()
 {
     if(statsTracker)
         statsTracker->done();
+
+    if(stats::stateMergeAttempts) {
+        S2EExecutionState::printMergeStatistics(m_s2e->getMessagesStream());
+    }
+
+    if (m_tbProfiler) {
+        m_tbProfiler->dump();
+        delete m_tbProfiler;
+    }
+
+    delete m_dirtyPages;
 }
 
 S2EExecutionState* S2EExecutor::createInitialState()
@@ -1143,6 +1239,11 @@ void S2EExecutor::initializeExecution(S2EExecutionState* state,
 
     initTimers();
     initializeStateSwitchTimer();
+
+    if (m_tbProfiler) {
+        m_s2e->getCorePlugin()->onTimer.connect(
+                sigc::mem_fun(*m_tbProfiler, &TBProfiler::onTimer));
+    }
 }
 
 void S2EExecutor::registerCpu(S2EExecutionState *initialState,
@@ -1176,6 +1277,7 @@ void S2EExecutor::registerCpu(S2EExecutionState *initialState,
     initialState->m_cpuSystemState->setName("CpuSystemState");
 
     m_saveOnContextSwitch.push_back(initialState->m_cpuSystemState);
+    m_saveOnContextSwitchUntracked.push_back(initialState->m_cpuSystemState);
 
     const ObjectState *cpuSystemObject = initialState->addressSpace
                                 .findObject(initialState->m_cpuSystemState);
@@ -1240,6 +1342,17 @@ void S2EExecutor::registerRam(S2EExecutionState *initialState,
         }
     }
 
+    if (DirtyTrackedStateSwitch && isSharedConcrete &&
+        (saveOnContextSwitch || !StateSharedMemory)) {
+        if (!m_dirtyPages) {
+            m_s2e->getWarningsStream()
+                    << "Dirty page tracking write-protects guest RAM, system calls"
+                    << " that write directly into it will fail with EFAULT\n";
+            m_dirtyPages = new DirtyPageTracker();
+        }
+        m_dirtyPages->addRegion(hostAddress, size);
+    }
+
     if(!isSharedConcrete) {
         /* XXX */
         /* XXX : use qemu_mprotect */
@@ -1269,6 +1382,7 @@ void S2EExecutor::registerDirtyMask(S2EExecutionState *initial_state, uint64_t h
     initial_state->m_dirtyMask->setName("dirtyMask");
 
     m_saveOnContextSwitch.push_back(initial_state->m_dirtyMask);
+    m_saveOnContextSwitchUntracked.push_back(initial_state->m_dirtyMask);
 
     const ObjectState *dirtyMaskObject = initial_state->addressSpace
                                 .findObject(initial_state->m_dirtyMask);
@@ -1286,6 +1400,9 @@ void S2EExecutor::switchToConcrete(S2EExecutionState *state)
     ObjectState* wos = state->m_cpuRegistersObject;
     assert(wos);
 
+    //KLEE may have written to the registers since the mask was cached
+    state->invalidateSymbolicRegistersMask();
+
     if (m_forceConcretizations) {
         //XXX: Find a adhoc dirty way to implement overconstrained consistency model
         //There should be a consistency plugin somewhere else
@@ -1339,6 +1456,7 @@ void S2EExecutor::switchToSymbolic(S2EExecutionState *state)
     memcpy(wos->getConcreteStore(true),
            (void*) state->m_cpuRegistersState->address, wos->size);
     state->m_runningConcrete = false;
+    state->invalidateSymbolicRegistersMask();
 
     if (PrintModeSwitch) {
         m_s2e->getMessagesStream(state)
@@ -1361,7 +1479,19 @@ bool S2EExecutor::copyInConcretes(klee::ExecutionState &state)
 
 void S2EExecutor::doLoadBalancing()
 {
-    if (states.size() < 2) {
+    std::vector<ExecutionState*> allStates;
+
+    for ( klee::ExecutionState *state : states )  {
+        S2EExecutionState *s2estate = static_cast<S2EExecutionState*>(state);
+        if (!s2estate->isZombie()) {
+            allStates.push_back(s2estate);
+        }
+    }
+
+    //Advertise our queue depth, idle instances publish zero
+    m_s2e->setCurrentStateCount(allStates.size());
+
+    if (allStates.size() < 2) {
         return;
     }
 
@@ -1370,50 +1500,89 @@ void S2EExecutor::doLoadBalancing()
         return;
     }
 
-    std::vector<ExecutionState*> allStates;
+    //Free slots go to the instance that has the most work,
+    //instead of to whichever instance happens to check first.
+    if (!m_s2e->isMostLoadedProcess()) {
+        return;
+    }
 
-    for ( klee::ExecutionState *state : states )  {
-        S2EExecutionState *s2estate = static_cast<S2EExecutionState*>(state);
-        if (!s2estate->isZombie()) {
-            allStates.push_back(s2estate);
+    if (VerboseStateSwitching) {
+        llvm::raw_ostream &os = g_s2e->getDebugStream();
+        os << "LoadBalancing: queue depths";
+        for (unsigned i = 0; i < m_s2e->getMaxProcesses(); ++i) {
+            os << " " << m_s2e->getStateCount(i);
         }
+        os << "\n";
     }
 
-    if (allStates.size() < 2) {
-        return;
+    //Split the states into as many slices as there are processes
+    //participating in this round. The current process keeps slice 0.
+    unsigned freeSlots = m_s2e->getMaxProcesses() - m_s2e->getCurrentProcessCount();
+    unsigned slices = std::min(freeSlots, (unsigned) LoadBalancingFanOut) + 1;
+    if (slices > allStates.size()) {
+        slices = allStates.size();
     }
 
-    g_s2e->getDebugStream() << "LoadBalancing: starting\n";
+    g_s2e->getDebugStream() << "LoadBalancing: starting (" << slices << " slices)\n";
 
     m_inLoadBalancing = true;
 
     vm_stop(RUN_STATE_SAVE_VM);
 
     unsigned parentId = m_s2e->getCurrentProcessIndex();
-    m_s2e->getCorePlugin()->onProcessFork.emit(true, false, -1);
-    int child = m_s2e->fork();
-    if (child < 0) {
-        //Fork did not succeed
-        m_s2e->getCorePlugin()->onProcessFork.emit(false, false, -1);
+    unsigned slice = 0;
+    unsigned created = 1;
+    bool child = false;
+
+    for (unsigned i = 1; i < slices; ++i) {
+        m_s2e->getCorePlugin()->onProcessFork.emit(true, false, -1);
+        int ret = m_s2e->fork();
+        if (ret < 0) {
+            //Fork did not succeed, the parent keeps the remaining slices
+            m_s2e->getCorePlugin()->onProcessFork.emit(false, false, -1);
+            break;
+        }
+
+        child = ret;
+        m_s2e->getCorePlugin()->onProcessFork.emit(false, child, parentId);
+
+        if (child) {
+            slice = i;
+            break;
+        }
+        ++created;
+    }
+
+    //The child writes its own profile, without the parent's counts
+    if (child && m_tbProfiler) {
+        m_tbProfiler->clear();
+    }
+
+    if (!child && created == 1) {
         m_inLoadBalancing = false;
         vm_start();
         return;
     }
 
     unsigned size = allStates.size();
-    unsigned n = size / 2;
-    unsigned lower = child ? 0 : n;
-    unsigned upper = child ? n : size;
-
-    m_s2e->getCorePlugin()->onProcessFork.emit(false, child, parentId);
+    unsigned lower = slice * size / slices;
+    unsigned upper = (slice + 1) * size / slices;
+    //Slices whose fork failed are also kept by the parent
+    unsigned orphans = child ? size : created * size / slices;
 
     g_s2e->getDebugStream() << "LoadBalancing: terminating states\n";
 
-    for (unsigned i=lower; i<upper; ++i) {
+    for (unsigned i = 0; i < size; ++i) {
+        if ((i >= lower && i < upper) || i >= orphans) {
+            continue;
+        }
         S2EExecutionState *s2estate = static_cast<S2EExecutionState*>(allStates[i]);
         terminateStateAtFork(*s2estate);
     }
 
+    unsigned kept = (upper - lower) + (size - orphans);
+    m_s2e->setCurrentStateCount(kept);
+
     m_s2e->getCorePlugin()->onProcessForkComplete.emit(child);
 
     m_inLoadBalancing = false;
@@ -1456,6 +1625,10 @@ void S2EExecutor::doStateSwitch(S2EExecutionState* oldState,
     assert(!newState || !newState->m_active);
     assert(!newState || !newState->m_runningConcrete);
 
+    if(oldState) {
+        m_s2e->getCorePlugin()->flushMemoryAccesses(oldState);
+    }
+
     //Some state save/restore logic in QEMU flushes the cache.
     //This can have bad effects in case of saving/restoring states
     //that were in the middle of a memory operation. Therefore,
@@ -1475,6 +1648,10 @@ void S2EExecutor::doStateSwitch(S2EExecutionState* oldState,
             << "Switching from state " << (oldState ? oldState->getID() : -1)
             << " to state " << (newState ? newState->getID() : -1) << '\n';
 
+    if (newState) {
+        newState->flushTranslationCache();
+    }
+
     const MemoryObject* cpuMo = oldState ? oldState->m_cpuSystemState :
                                             newState->m_cpuSystemState;
 
@@ -1529,7 +1706,12 @@ void S2EExecutor::doStateSwitch(S2EExecutionState* oldState,
 
     uint64_t totalCopied = 0;
     uint64_t objectsCopied = 0;
-    for( MemoryObject* mo : m_saveOnContextSwitch ) {
+
+    //With dirty tracking, RAM is handled by saveDirtyRam and restoreDirtyRam
+    const std::vector<MemoryObject*> &objects = m_dirtyPages ?
+            m_saveOnContextSwitchUntracked : m_saveOnContextSwitch;
+
+    for( MemoryObject* mo : objects ) {
         if(mo == cpuMo)
             continue;
 
@@ -1552,10 +1734,24 @@ void S2EExecutor::doStateSwitch(S2EExecutionState* oldState,
         objectsCopied++;
     }
 
+    if (m_dirtyPages) {
+        if (oldState) {
+            saveDirtyRam(oldState, totalCopied, objectsCopied);
+        }
+
+        if (newState) {
+            restoreDirtyRam(oldState, newState, totalCopied, objectsCopied);
+        } else {
+            //Remember whose memory is left in place for the next switch
+            m_hostRamLog = oldState->m_ramWriteLog;
+            m_hostRamLogValid = true;
+        }
+    }
+
     cpu_enable_ticks();
 
     if (VerboseStateSwitching) {
-        s2e_debug_print("Copied %d (count=%d)\n", totalCopied, objectsCopied);
+        s2e_debug_print("Copied %" PRIu64 " (count=%" PRIu64 ")\n", totalCopied, objectsCopied);
     }
 
     if(FlushTBsOnStateSwitch)
@@ -1679,6 +1875,8 @@ void S2EExecutor::prepareFunctionExecution(S2EExecutionState *state,
     if(it != kmodule->functionMap.end()) {
         kf = it->second;
     } else {
+        TimerStatIncrementer t(stats::functionPreparationTime);
+        ++stats::functionPreparations;
 
         unsigned cIndex = kmodule->constants.size();
         kf = kmodule->updateModuleWithFunction(function);
@@ -1688,24 +1886,7 @@ void S2EExecutor::prepareFunctionExecution(S2EExecutionState *state,
 
         /* Update global functions (new functions can be added
            while creating added function) */
-        for (Module::iterator i = kmodule->module->begin(),
-                              ie = kmodule->module->end(); i != ie; ++i) {
-            Function *f = i;
-            ref<klee::ConstantExpr> addr(0);
-
-            // If the symbol has external weak linkage then it is implicitly
-            // not defined in this module; if it isn't resolvable then it
-            // should be null.
-            if (f->hasExternalWeakLinkage() &&
-                    !externalDispatcher->resolveSymbol(f->getName())) {
-                addr = Expr::createPointer(0);
-            } else {
-                addr = Expr::createPointer((uintptr_t) (void*) f);
-                legalFunctions.insert((uint64_t) (uintptr_t) (void*) f);
-            }
-
-            globalAddresses.insert(std::make_pair(f, addr));
-        }
+        registerReferencedFunctions(function);
 
         kmodule->constantTable.resize(kmodule->constants.size());
 
@@ -1730,6 +1911,73 @@ void S2EExecutor::prepareFunctionExecution(S2EExecutionState *state,
         bindArgument(kf, i, *state, args[i]);
 }
 
+void S2EExecutor::registerFunctionAddress(llvm::Function *f)
+{
+    if (globalAddresses.count(f)) {
+        return;
+    }
+
+    ref<klee::ConstantExpr> addr(0);
+
+    // If the symbol has external weak linkage then it is implicitly
+    // not defined in this module; if it isn't resolvable then it
+    // should be null.
+    if (f->hasExternalWeakLinkage() &&
+            !externalDispatcher->resolveSymbol(f->getName())) {
+        addr = Expr::createPointer(0);
+    } else {
+        addr = Expr::createPointer((uintptr_t) (void*) f);
+        legalFunctions.insert((uint64_t) (uintptr_t) (void*) f);
+    }
+
+    globalAddresses.insert(std::make_pair(f, addr));
+}
+
+/**
+ * Registers the addresses of the function and of every function it
+ * refers to, including declarations added by KModule while lowering it.
+ * Functions that were registered before are skipped, so the cost does
+ * not depend on the size of the module.
+ */
+void S2EExecutor::registerReferencedFunctions(llvm::Function *function)
+{
+    registerFunctionAddress(function);
+
+    llvm::SmallPtrSet<const llvm::Constant*, 32> visited;
+    llvm::SmallVector<const llvm::Constant*, 32> worklist;
+
+    for (Function::iterator bb = function->begin(); bb != function->end(); ++bb) {
+        for (BasicBlock::iterator i = bb->begin(); i != bb->end(); ++i) {
+            for (unsigned op = 0; op < i->getNumOperands(); ++op) {
+                const llvm::Constant *c = dyn_cast<llvm::Constant>(i->getOperand(op));
+                if (c && visited.insert(c)) {
+                    worklist.push_back(c);
+                }
+            }
+        }
+    }
+
+    while (!worklist.empty()) {
+        const llvm::Constant *c = worklist.pop_back_val();
+
+        if (const Function *f = dyn_cast<Function>(c)) {
+            registerFunctionAddress(const_cast<Function*>(f));
+            continue;
+        }
+
+        if (isa<llvm::GlobalValue>(c)) {
+            continue;
+        }
+
+        for (unsigned op = 0; op < c->getNumOperands(); ++op) {
+            const llvm::Constant *opc = cast<llvm::Constant>(c->getOperand(op));
+            if (visited.insert(opc)) {
+                worklist.push_back(opc);
+            }
+        }
+    }
+}
+
 inline bool S2EExecutor::executeInstructions(S2EExecutionState *state, unsigned callerStackSize)
 {
     try {
@@ -1864,6 +2112,15 @@ uintptr_t S2EExecutor::executeTranslationBlockKlee(
 
     ++state->m_stats.m_statTranslationBlockSymbolic;
 
+    uint64_t profileInstructions = 0;
+    uint64_t profileStart = 0;
+    if (m_tbProfiler) {
+        m_tbProfiler->beginSymbolic(tb->pc);
+        profileInstructions = state->m_stats.m_statInstructionCountSymbolic;
+        llvm::sys::TimeValue now = llvm::sys::TimeValue::now();
+        profileStart = now.seconds() * 1000000 + now.microseconds();
+    }
+
     /* Generate LLVM code if necessary */
     assert(tb->tcg_plugin_opaque);
     if(!static_cast<TCGPluginTBData *>(tb->tcg_plugin_opaque)->llvm_function) {
@@ -1885,12 +2142,33 @@ uintptr_t S2EExecutor::executeTranslationBlockKlee(
 //    }
     assert(false && "J stubbed");
 
+    /* Hot blocks switch to an optimized copy of their function,
+       which gets its own KFunction when first prepared */
+    TCGPluginTBData *tbData = static_cast<TCGPluginTBData *>(tb->tcg_plugin_opaque);
+    llvm::Function *function = tbData->llvm_optimized_function;
+    if (!function) {
+        function = tbData->llvm_function;
+        if (TBOptimizationThreshold &&
+                ++tbData->execution_count >= TBOptimizationThreshold) {
+            function = m_tcgLLVMContext->getOptimizedFunction(function);
+            tbData->llvm_optimized_function = function;
+        }
+    }
+
     /* Prepare function execution */
-    prepareFunctionExecution(state,
-            static_cast<TCGPluginTBData *>(tb->tcg_plugin_opaque)->llvm_function, std::vector<ref<Expr> >(1,
+    prepareFunctionExecution(state, function, std::vector<ref<Expr> >(1,
                 Expr::createPointer((uint64_t) tb_function_args)));
 
-    if (executeInstructions(state)) {
+    bool exited = executeInstructions(state);
+
+    if (m_tbProfiler) {
+        llvm::sys::TimeValue now = llvm::sys::TimeValue::now();
+        m_tbProfiler->endSymbolic(
+                state->m_stats.m_statInstructionCountSymbolic - profileInstructions,
+                now.seconds() * 1000000 + now.microseconds() - profileStart);
+    }
+
+    if (exited) {
         throw CpuExitException();
     }
 
@@ -1908,6 +2186,10 @@ uintptr_t S2EExecutor::executeTranslationBlockConcrete(S2EExecutionState *state,
     assert(state->m_active && state->m_runningConcrete);
     ++state->m_stats.m_statTranslationBlockConcrete;
 
+    if (m_tbProfiler) {
+        m_tbProfiler->recordConcrete(tb->pc);
+    }
+
     uintptr_t ret = 0;
     //TODO[J] stubbed
 //    memcpy(s2e_cpuExitJmpBuf, env->jmp_env, sizeof(env->jmp_env));
@@ -2077,7 +2359,11 @@ uintptr_t S2EExecutor::executeTranslationBlock(
 //        cpu_enable_scaling(slowdown);
         assert(false && "J stubbed");
 
-        return executeTranslationBlockKlee(state, tb);
+        uintptr_t ret = executeTranslationBlockKlee(state, tb);
+        if(!state->m_memoryAccesses.empty()) {
+            m_s2e->getCorePlugin()->flushMemoryAccesses(state);
+        }
+        return ret;
 
     } else {
         //g_s2e_exec_ret_addr = 0;
@@ -2096,7 +2382,11 @@ uintptr_t S2EExecutor::executeTranslationBlock(
 //        cpu_enable_scaling(new_scaling);
         assert(false && "J stubbed");
 
-        return executeTranslationBlockConcrete(state, tb);
+        uintptr_t ret = executeTranslationBlockConcrete(state, tb);
+        if(!state->m_memoryAccesses.empty()) {
+            m_s2e->getCorePlugin()->flushMemoryAccesses(state);
+        }
+        return ret;
     }
 }
 
@@ -2240,6 +2530,10 @@ S2EExecutor::StatePair S2EExecutor::fork(ExecutionState &current,
         newConditions[0] = condition;
         newConditions[1] = klee::NotExpr::create(condition);
 
+        if (m_tbProfiler) {
+            m_tbProfiler->recordFork();
+        }
+
         doStateFork(static_cast<S2EExecutionState*>(&current),
                        newStates, newConditions);
     }
@@ -2254,6 +2548,9 @@ void S2EExecutor::notifyBranch(ExecutionState &state)
 {
     S2EExecutionState *s2eState = dynamic_cast<S2EExecutionState*>(&state);
 
+    /* Pending accesses happened before the fork, report them only once */
+    m_s2e->getCorePlugin()->flushMemoryAccesses(s2eState);
+
     /* Checkpoint the device state before branching */
     //TODO[J] stubbed
 //    qemu_aio_flush();
@@ -2273,13 +2570,121 @@ void S2EExecutor::notifyBranch(ExecutionState &state)
     assert(false && "J stubbed");
     cpu_enable_ticks();
 
-    for( MemoryObject* mo : m_saveOnContextSwitch ) {
+    const std::vector<MemoryObject*> &objects = m_dirtyPages ?
+            m_saveOnContextSwitchUntracked : m_saveOnContextSwitch;
+
+    for( MemoryObject* mo : objects ) {
         const ObjectState *os = s2eState->addressSpace.findObject(mo);
         ObjectState *wos = s2eState->addressSpace.getWriteable(mo, os);
         uint8_t *store = wos->getConcreteStore();
         assert(store);
         memcpy(store, (uint8_t*) mo->address, mo->size);
     }
+
+    //The forked states share the stores that now match the host memory
+    if (m_dirtyPages) {
+        uint64_t bytes = 0, count = 0;
+        saveDirtyRam(s2eState, bytes, count);
+    }
+}
+
+/** Copies the RAM pages written since the last save into the saved
+    copies of the state and logs the updated objects */
+void S2EExecutor::saveDirtyRam(S2EExecutionState *state,
+                               uint64_t &bytes, uint64_t &count)
+{
+    m_dirtyPageList.clear();
+    m_dirtyPages->collectDirtyPages(m_dirtyPageList);
+
+    //RAM objects are never larger than a page
+    uintptr_t pageSize = m_dirtyPages->getPageSize();
+    for (uintptr_t page : m_dirtyPageList) {
+        for (uintptr_t addr = page; addr < page + pageSize; addr += S2E_RAM_OBJECT_SIZE) {
+            ObjectPair op = state->addressSpace.findObject(addr);
+            assert(op.first && op.first->address == addr);
+
+            ObjectState *wos = state->addressSpace.getWriteable(op.first, op.second);
+            uint8_t *store = wos->getConcreteStore();
+            assert(store);
+            memcpy(store, (uint8_t*) addr, op.first->size);
+
+            state->logRamWrite(op.first);
+            bytes += op.first->size;
+            ++count;
+        }
+    }
+}
+
+/** Brings the host RAM from the contents of oldState (or of the last
+    state switched out, if NULL) to the contents of newState. Only the
+    objects logged by either state since their closest common ancestor
+    may differ. */
+void S2EExecutor::restoreDirtyRam(S2EExecutionState *oldState,
+                                  S2EExecutionState *newState,
+                                  uint64_t &bytes, uint64_t &count)
+{
+    std::vector<const MemoryObject*> &restore = m_ramRestoreList;
+    restore.clear();
+
+    if (!oldState && !m_hostRamLogValid) {
+        restore.assign(m_saveOnContextSwitch.begin(), m_saveOnContextSwitch.end());
+    } else {
+        if (!oldState) {
+            //Nobody saved the pages written while no state was active
+            m_dirtyPageList.clear();
+            m_dirtyPages->collectDirtyPages(m_dirtyPageList);
+
+            uintptr_t pageSize = m_dirtyPages->getPageSize();
+            for (uintptr_t page : m_dirtyPageList) {
+                for (uintptr_t addr = page; addr < page + pageSize; addr += S2E_RAM_OBJECT_SIZE) {
+                    restore.push_back(newState->addressSpace.findObject(addr).first);
+                }
+            }
+        }
+
+        const RamWriteLog *a = oldState ? oldState->m_ramWriteLog.get() : m_hostRamLog.get();
+        const RamWriteLog *b = newState->m_ramWriteLog.get();
+        while (a != b) {
+            if (!b || (a && a->depth >= b->depth)) {
+                restore.insert(restore.end(), a->objects.begin(), a->objects.end());
+                a = a->parent.get();
+            } else {
+                restore.insert(restore.end(), b->objects.begin(), b->objects.end());
+                b = b->parent.get();
+            }
+        }
+    }
+
+    m_hostRamLog.reset();
+    m_hostRamLogValid = false;
+
+    if (restore.empty()) {
+        return;
+    }
+
+    std::sort(restore.begin(), restore.end());
+    restore.erase(std::unique(restore.begin(), restore.end()), restore.end());
+
+    //Clean pages are read-only, one call per region is much cheaper
+    //than taking a fault on each restored page
+    m_dirtyPages->unprotectAll();
+
+    for (const MemoryObject *mo : restore) {
+        //Untracked objects are handled by doStateSwitch
+        if (!m_dirtyPages->isTracked(mo->address)) {
+            continue;
+        }
+
+        const ObjectState *os = newState->addressSpace.findObject(mo);
+        const uint8_t *store = os->getConcreteStore();
+        assert(store);
+        memcpy((uint8_t*) mo->address, store, mo->size);
+
+        bytes += mo->size;
+        ++count;
+    }
+
+    m_dirtyPages->protectAll();
 }
 
 void S2EExecutor::branch(klee::ExecutionState &state,
@@ -2326,7 +2731,15 @@ bool S2EExecutor::merge(klee::ExecutionState &_base, klee::ExecutionState &_othe
     else if(other.m_active)
         doStateSwitch(&other, NULL);
 
-    if(base.merge(other)) {
+    ++stats::stateMergeAttempts;
+    bool merged;
+    {
+        TimerStatIncrementer t(stats::stateMergeTime);
+        merged = base.merge(other);
+    }
+
+    if(merged) {
+        ++stats::stateMerges;
         m_s2e->getMessagesStream(&base)
                 << "Merged with state " << other.getID() << '\n';
         return true;
@@ -2356,6 +2769,7 @@ void S2EExecutor::terminateStateEarly(klee::ExecutionState &state, const llvm::T
 void S2EExecutor::terminateState(ExecutionState &s)
 {
     S2EExecutionState& state = static_cast<S2EExecutionState&>(s);
+    m_s2e->getCorePlugin()->flushMemoryAccesses(&state);
     m_s2e->getCorePlugin()->onStateKill.emit(&state);
 
     terminateStateAtFork(state);
@@ -2572,14 +2986,20 @@ bool S2EExecutor::resumeState(S2EExecutionState *state, bool onlyAddToPtree)
 void S2EExecutor::unrefS2ETb(S2ETranslationBlock* s2e_tb)
 {
     if(s2e_tb && 0 == --s2e_tb->refCount) {
-        if(s2e_tb->llvm_function && !KeepLLVMFunctions) {
-            S2EExternalDispatcher *s2eDispatcher = static_cast<S2EExternalDispatcher*>(externalDispatcher);
-            s2eDispatcher->removeFunction(s2e_tb->llvm_function);
-            kmodule->removeFunction(s2e_tb->llvm_function);
-        }
-        for( void* s : s2e_tb->executionSignals ) {
-            delete static_cast<ExecutionSignal*>(s);
+        //The function may be shared with identical translation blocks,
+        //or kept prepared for a retranslation of the same code
+        if(s2e_tb->llvm_function) {
+            std::vector<llvm::Function*> evicted;
+            m_tcgLLVMContext->releaseFunction(s2e_tb->llvm_function, evicted);
+            if(!KeepLLVMFunctions) {
+                S2EExternalDispatcher *s2eDispatcher = static_cast<S2EExternalDispatcher*>(externalDispatcher);
+                for(unsigned i = 0; i < evicted.size(); ++i) {
+                    s2eDispatcher->removeFunction(evicted[i]);
+                    kmodule->removeFunction(evicted[i]);
+                }
+            }
         }
+        m_executionSignalPool.release(s2e_tb->executionSignals);
     }
 }
 
@@ -2784,7 +3204,8 @@ void s2e_tb_alloc(S2E*, TranslationBlock *tb)
 //    tb->s2e_tb->refCount = 1;
 //
 //    /* Push one copy of a signal to use it as a cache */
-//    tb->s2e_tb->executionSignals.push_back(new s2e::ExecutionSignal);
+//    tb->s2e_tb->executionSignals.push_back(
+//            g_s2e->getExecutor()->getExecutionSignalPool().allocate());
 //
 //    tb->s2e_tb_next[0] = 0;
 //    tb->s2e_tb_next[1] = 0;
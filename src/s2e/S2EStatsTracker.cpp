@@ -48,9 +48,14 @@
 
 #include <sstream>
 
+#include <s2e/S2EDeviceState.h>
+
+#include <tcgplugin/tcg-llvm.h>
+
 #include <unistd.h>
 #include <stdio.h>
 #include <inttypes.h>
+#include <fcntl.h>
 
 #include "config.h"
 
@@ -76,6 +81,13 @@ namespace stats {
 
     Statistic concreteModeTime("ConcreteModeTime", "ConcModeTime");
     Statistic symbolicModeTime("SymbolicModeTime", "SymbModeTime");
+
+    Statistic stateMergeAttempts("StateMergeAttempts", "MergeAttempts");
+    Statistic stateMerges("StateMerges", "Merges");
+    Statistic stateMergeTime("StateMergeTime", "MergeTime");
+
+    Statistic functionPreparations("FunctionPreparations", "FnPreps");
+    Statistic functionPreparationTime("FunctionPreparationTime", "FnPrepTime");
 } // namespace stats
 } // namespace klee
 
@@ -85,6 +97,48 @@ using namespace llvm;
 
 namespace s2e {
 
+#if !defined(CONFIG_WIN32) && !defined(CONFIG_DARWIN)
+/**
+ *  Reads /proc/self/statm through a descriptor that stays open,
+ *  so that sampling costs a single pread. The descriptor is
+ *  reopened after a fork, it would describe the parent otherwise.
+ */
+static bool readStatm(uint64_t &virtualSize, uint64_t &residentSize)
+{
+    static int s_fd = -1;
+    static pid_t s_pid = 0;
+
+    pid_t pid = getpid();
+    if (s_fd < 0 || s_pid != pid) {
+        if (s_fd >= 0) {
+            close(s_fd);
+        }
+        s_fd = open("/proc/self/statm", O_RDONLY);
+        s_pid = pid;
+        if (s_fd < 0) {
+            return false;
+        }
+    }
+
+    char buffer[128];
+    ssize_t size = pread(s_fd, buffer, sizeof(buffer) - 1, 0);
+    if (size <= 0) {
+        return false;
+    }
+    buffer[size] = 0;
+
+    uint64_t pages = 0, residentPages = 0;
+    if (sscanf(buffer, "%" PRIu64 " %" PRIu64, &pages, &residentPages) != 2) {
+        return false;
+    }
+
+    static uint64_t s_pageSize = sysconf(_SC_PAGESIZE);
+    virtualSize = pages * s_pageSize;
+    residentSize = residentPages * s_pageSize;
+    return true;
+}
+#endif
+
 /**
  *  Replaces the broken LLVM functions
  */
@@ -116,27 +170,33 @@ uint64_t S2EStatsTracker::getProcessMemoryUsage()
     return t_info.resident_size;
 
 #else
-    pid_t myPid = getpid();
-    std::stringstream ss;
-    ss << "/proc/" << myPid << "/status";
-
-    FILE *fp = fopen(ss.str().c_str(), "r");
-    if (!fp) {
+    uint64_t virtualSize, residentSize;
+    if (!readStatm(virtualSize, residentSize)) {
         return 0;
     }
+    return virtualSize;
+#endif
+}
 
-    uint64_t peakMem=0;
-
-    char buffer[512];
-    while(!peakMem && fgets(buffer, sizeof(buffer), fp)) {
-        if (sscanf(buffer, "VmSize: %" PRIu64, &peakMem)) {
-            break;
-        }
+uint64_t S2EStatsTracker::getProcessResidentMemory()
+{
+#if defined(CONFIG_WIN32)
+    PROCESS_MEMORY_COUNTERS Memory;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &Memory, sizeof(Memory))) {
+        return 0;
     }
+    return Memory.WorkingSetSize;
 
-    fclose(fp);
+#elif defined(CONFIG_DARWIN)
+    //Already the resident size
+    return getProcessMemoryUsage();
 
-    return peakMem * 1024;
+#else
+    uint64_t virtualSize, residentSize;
+    if (!readStatm(virtualSize, residentSize)) {
+        return 0;
+    }
+    return residentSize;
 #endif
 }
 
@@ -159,6 +219,11 @@ void S2EStatsTracker::writeStatsHeader() {
              << "'CpuInstructionsKlee',"
              << "'ConcreteModeTime',"
              << "'SymbolicModeTime',"
+             << "'StateMergeAttempts',"
+             << "'StateMerges',"
+             << "'StateMergeTime',"
+             << "'FunctionPreparations',"
+             << "'FunctionPreparationTime',"
              << "'UserTime',"
              << "'WallTime',"
              << "'QueryTime',"
@@ -167,11 +232,18 @@ void S2EStatsTracker::writeStatsHeader() {
              << "'ForkTime',"
              << "'ResolveTime',"
              << "'MemoryUsage',"
+             << "'ResidentMemory',"
+             << "'LLVMFunctionBytes',"
+             << "'DeviceSnapshotBytes',"
+             << "'SharedTranslations',"
+             << "'OptimizedTranslations',"
              << ")\n";
   statsFile->flush();
 }
 
 void S2EStatsTracker::writeStatsLine() {
+  TCGLLVMContext *tcgLLVMContext = static_cast<S2EExecutor&>(executor).getTCGLLVMContext();
+
   *statsFile //<< "(" << stats::instructions
              //<< "," << fullBranches
              //<< "," << partialBranches
@@ -190,6 +262,11 @@ void S2EStatsTracker::writeStatsLine() {
              << "," << stats::cpuInstructionsKlee
              << "," << stats::concreteModeTime / 1000000.
              << "," << stats::symbolicModeTime / 1000000.
+             << "," << stats::stateMergeAttempts
+             << "," << stats::stateMerges
+             << "," << stats::stateMergeTime / 1000000.
+             << "," << stats::functionPreparations
+             << "," << stats::functionPreparationTime / 1000000.
              << "," << util::getUserTime()
              << "," << elapsed()
              << "," << stats::queryTime / 1000000.
@@ -198,6 +275,11 @@ void S2EStatsTracker::writeStatsLine() {
              << "," << stats::forkTime / 1000000.
              << "," << stats::resolveTime / 1000000.
              << "," << getProcessMemoryUsage() //sys::Process::GetTotalMemoryUsage()
+             << "," << getProcessResidentMemory()
+             << "," << tcgLLVMContext->getFunctionBytes()
+             << "," << S2EDeviceState::getSnapshotBytes()
+             << "," << tcgLLVMContext->getSharedFunctionHits()
+             << "," << tcgLLVMContext->getOptimizedFunctions()
              << ")\n";
   statsFile->flush();
 }
@@ -0,0 +1,80 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+#include <s2e/Signals.h>
+
+#include <assert.h>
+
+namespace s2e {
+
+ExecutionSignalPool::ExecutionSignalPool(): m_liveSignals(0)
+{
+}
+
+ExecutionSignalPool::~ExecutionSignalPool()
+{
+    for (unsigned i = 0; i < m_chunks.size(); ++i) {
+        delete [] m_chunks[i];
+    }
+}
+
+void ExecutionSignalPool::grow()
+{
+    ExecutionSignal *chunk = new ExecutionSignal[CHUNK_SIGNALS];
+    m_chunks.push_back(chunk);
+
+    //Hand out the signals in address order
+    m_free.reserve(m_free.size() + CHUNK_SIGNALS);
+    for (unsigned i = CHUNK_SIGNALS; i > 0; --i) {
+        m_free.push_back(&chunk[i - 1]);
+    }
+}
+
+void ExecutionSignalPool::release(std::vector<ExecutionSignal*> &signals)
+{
+    assert(m_liveSignals >= signals.size());
+
+    m_free.reserve(m_free.size() + signals.size());
+    for (unsigned i = 0; i < signals.size(); ++i) {
+        signals[i]->clear();
+        m_free.push_back(signals[i]);
+    }
+
+    m_liveSignals -= signals.size();
+    signals.clear();
+}
+
+}
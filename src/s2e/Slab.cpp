@@ -58,6 +58,7 @@ namespace s2e
 
 PageAllocator::PageAllocator()
 {
+    m_mappedRegions = 0;
 
 }
 
@@ -111,6 +112,7 @@ uintptr_t PageAllocator::allocPage()
 #endif
 
         m_regions[region] = ((uint64_t)-1) & ~1LL;
+        ++m_mappedRegions;
         return region;
     }
 
@@ -168,6 +170,7 @@ void PageAllocator::freePage(uintptr_t page)
 
         osFree((*it).first);
         m_regions.erase((*it).first);
+        --m_mappedRegions;
     }
 
     return;
@@ -429,16 +432,23 @@ bool SlabAllocator::isValid(uintptr_t addr) const
     return getSlab(addr) != NULL;
 }
 
-void SlabAllocator::printStats(std::ostream &os) const
+uint64_t SlabAllocator::getAllocatedBytes() const
 {
     uint64_t totalSize = 0;
+    for (unsigned i=m_minPo2; i<= m_maxPo2; ++i) {
+        totalSize += (1<<i) * m_bas[i-m_minPo2]->getAllocatedBlocksCount();
+    }
+    return totalSize;
+}
 
+void SlabAllocator::printStats(std::ostream &os) const
+{
     os << std::dec << "Allocator statistics" << std::endl;
     for (unsigned i=m_minPo2; i<= m_maxPo2; ++i) {
-        totalSize += (1<<i) * m_bas[i-m_minPo2]->getAllocatedBlocksCount();
         os << "[" << (1<<i) <<  "] allocatedBlocks:" << m_bas[i-m_minPo2]->getAllocatedBlocksCount() << std::endl;
     }
-    os << "Total size:" << totalSize << std::endl;
+    os << "Total size:" << getAllocatedBytes() << std::endl;
+    os << "Mapped size:" << m_pa->getMappedBytes() << std::endl;
 }
 
 static SlabAllocator *s_slab = NULL;
@@ -34,8 +34,8 @@
  */
 
 #include <cassert>
+#include <stdio.h>
 
-#include "s2e/S2E.h"
 #include "config-host.h"
 #include "s2e/Synchronization.h"
 
@@ -91,27 +91,6 @@ void S2ESynchronizedObjectInternal::release()
 
 }
 
-uint64_t AtomicFunctions::read(uint64_t *address)
-{
-   return __sync_fetch_and_add(address, 0);
-}
-
-void AtomicFunctions::add(uint64_t *address, uint64_t value)
-{
-    __sync_fetch_and_add(address, value);
-}
-
-void AtomicFunctions::sub(uint64_t *address, uint64_t value)
-{
-    __sync_fetch_and_sub(address, value);
-}
-
-
-void AtomicFunctions::write(uint64_t *address, uint64_t value)
-{
-    *address = value;
-}
-
 #else
 
 
@@ -212,9 +191,19 @@ void S2ESynchronizedObjectInternal::release()
 #endif
 }
 
+#endif
+
+/* The counters live in memory shared between the S2E processes, the
+   __atomic builtins are lock-free there as long as the accesses are
+   aligned. Plain loads and stores do not need a locked instruction. */
 uint64_t AtomicFunctions::read(uint64_t *address)
 {
-    return __sync_fetch_and_add(address, 0);
+    return __atomic_load_n(address, __ATOMIC_ACQUIRE);
+}
+
+void AtomicFunctions::write(uint64_t *address, uint64_t value)
+{
+    __atomic_store_n(address, value, __ATOMIC_RELEASE);
 }
 
 void AtomicFunctions::add(uint64_t *address, uint64_t value)
@@ -227,11 +216,29 @@ void AtomicFunctions::sub(uint64_t *address, uint64_t value)
     __sync_fetch_and_sub(address, value);
 }
 
-void AtomicFunctions::write(uint64_t *address, uint64_t value)
+unsigned AtomicFunctions::read(unsigned *address)
 {
-    *address = value;
+    return __atomic_load_n(address, __ATOMIC_ACQUIRE);
 }
 
-#endif
+void AtomicFunctions::write(unsigned *address, unsigned value)
+{
+    __atomic_store_n(address, value, __ATOMIC_RELEASE);
+}
+
+unsigned AtomicFunctions::fetchAndAdd(unsigned *address, unsigned value)
+{
+    return __sync_fetch_and_add(address, value);
+}
+
+unsigned AtomicFunctions::fetchAndSub(unsigned *address, unsigned value)
+{
+    return __sync_fetch_and_sub(address, value);
+}
+
+unsigned AtomicFunctions::compareAndSwap(unsigned *address, unsigned oldValue, unsigned newValue)
+{
+    return __sync_val_compare_and_swap(address, oldValue, newValue);
+}
 
 }
@@ -0,0 +1,146 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+#include <s2e/TBProfiler.h>
+#include <s2e/S2E.h>
+#include <s2e/Utils.h>
+
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <string.h>
+
+namespace s2e {
+
+namespace {
+    //Probes before giving up and counting in the overflow entry
+    const unsigned MaxProbes = 8;
+
+    bool compareEntries(const TBProfiler::Entry *a, const TBProfiler::Entry *b)
+    {
+        if (a->symbolicTime != b->symbolicTime) {
+            return a->symbolicTime > b->symbolicTime;
+        }
+        return a->concreteExecutions + a->symbolicExecutions >
+               b->concreteExecutions + b->symbolicExecutions;
+    }
+}
+
+TBProfiler::TBProfiler(S2E *s2e, unsigned sizeBits, unsigned dumpInterval)
+{
+    m_s2e = s2e;
+    m_entries.resize(1ULL << sizeBits);
+    m_mask = m_entries.size() - 1;
+    m_current = NULL;
+    m_dumpInterval = dumpInterval;
+    m_ticks = 0;
+    clear();
+}
+
+TBProfiler::Entry *TBProfiler::lookup(uint64_t pc)
+{
+    //Empty entries have pc == 0, store pc + 1 to allow guest address 0
+    uint64_t key = pc + 1;
+    uint64_t index = (key * 0x9E3779B97F4A7C15ULL) >> 32;
+
+    for (unsigned i = 0; i < MaxProbes; ++i) {
+        Entry *e = &m_entries[(index + i) & m_mask];
+        if (e->pc == key) {
+            return e;
+        }
+        if (!e->pc) {
+            e->pc = key;
+            return e;
+        }
+    }
+
+    return &m_overflow;
+}
+
+void TBProfiler::clear()
+{
+    memset(&m_entries[0], 0, m_entries.size() * sizeof(Entry));
+    memset(&m_overflow, 0, sizeof(m_overflow));
+    m_current = NULL;
+}
+
+void TBProfiler::dump()
+{
+    std::vector<const Entry*> sorted;
+    for (unsigned i = 0; i < m_entries.size(); ++i) {
+        if (m_entries[i].pc) {
+            sorted.push_back(&m_entries[i]);
+        }
+    }
+    std::sort(sorted.begin(), sorted.end(), compareEntries);
+
+    llvm::raw_ostream *report = m_s2e->openOutputFile("tbprofile.txt");
+    *report << "pc\tconcrete\tsymbolic\tllvm_instructions\tforks\tsymbolic_time_us\n";
+    for (unsigned i = 0; i < sorted.size(); ++i) {
+        const Entry *e = sorted[i];
+        *report << hexval(e->pc - 1) << '\t' << e->concreteExecutions << '\t'
+                << e->symbolicExecutions << '\t' << e->llvmInstructions << '\t'
+                << e->forks << '\t' << e->symbolicTime << '\n';
+    }
+    *report << "overflow\t" << m_overflow.concreteExecutions << '\t'
+            << m_overflow.symbolicExecutions << '\t' << m_overflow.llvmInstructions << '\t'
+            << m_overflow.forks << '\t' << m_overflow.symbolicTime << '\n';
+    delete report;
+
+    //One frame per execution mode and block, weighted by execution count.
+    //Can be fed directly to flamegraph.pl.
+    llvm::raw_ostream *folded = m_s2e->openOutputFile("tbprofile.folded");
+    for (unsigned i = 0; i < sorted.size(); ++i) {
+        const Entry *e = sorted[i];
+        if (e->concreteExecutions) {
+            *folded << "concrete;" << hexval(e->pc - 1) << ' ' << e->concreteExecutions << '\n';
+        }
+        if (e->symbolicExecutions) {
+            *folded << "symbolic;" << hexval(e->pc - 1) << ' ' << e->symbolicExecutions << '\n';
+        }
+    }
+    delete folded;
+}
+
+void TBProfiler::onTimer()
+{
+    if (m_dumpInterval && ++m_ticks >= m_dumpInterval) {
+        m_ticks = 0;
+        dump();
+    }
+}
+
+}
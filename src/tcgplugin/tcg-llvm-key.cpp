@@ -0,0 +1,109 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+#include "tcgplugin/cxx11-compat.h"
+
+extern "C" {
+#include "tcg.h"
+#include "tcg-plugin-api.h"
+}
+
+#include "tcgplugin/tcg-llvm.h"
+#include "tcgplugin/tcg-llvm-key.h"
+
+/* Two independent 64-bit hashes, so that collisions need both to collide */
+static inline void key_hash(uint64_t h[2], uint64_t value)
+{
+    for (unsigned i = 0; i < sizeof(value); ++i) {
+        h[0] ^= (value >> (i * 8)) & 0xff;
+        h[0] *= 1099511628211ULL;
+    }
+
+    h[1] = (h[1] ^ value) * 0x9e3779b97f4a7c15ULL;
+    h[1] ^= h[1] >> 29;
+}
+
+TCGLLVMFunctionKey TCGLLVMFunctionKey::compute(const TCGContext *s,
+                                               const TranslationBlock *tb)
+{
+    TCGLLVMFunctionKey key;
+    key.hash[0] = 14695981039346656037ULL;
+    key.hash[1] = 0;
+
+    key_hash(key.hash, tb->pc);
+    key_hash(key.hash, tb->cs_base);
+    key_hash(key.hash, tb->flags);
+
+    key_hash(key.hash, s->nb_globals);
+    key_hash(key.hash, s->nb_temps);
+    for (int i = 0; i < s->nb_temps; ++i) {
+        const TCGTemp &temp = s->temps[i];
+        key_hash(key.hash, temp.type);
+        key_hash(key.hash, temp.temp_local);
+        if (i < s->nb_globals) {
+            key_hash(key.hash, temp.fixed_reg);
+            key_hash(key.hash, temp.reg);
+            key_hash(key.hash, temp.mem_reg);
+            key_hash(key.hash, temp.mem_offset);
+        }
+    }
+
+    /* Argument counts follow TCGLLVMContextPrivate::generateOperation */
+    const TCGArg *args = s->gen_opparam_buf;
+    for (int opc_index = 0; ; ++opc_index) {
+        int opc = s->gen_opc_buf[opc_index];
+        key_hash(key.hash, opc);
+
+        if (opc == INDEX_op_end) {
+            break;
+        }
+
+        const TCGOpDef &def = tcg_op_defs[opc];
+        int nb_args = def.nb_args;
+        if (opc == INDEX_op_nopn) {
+            nb_args = args[0];
+        } else if (opc == INDEX_op_call) {
+            nb_args = (args[0] >> 16) + (args[0] & 0xffff) + def.nb_cargs + 1;
+        }
+
+        for (int i = 0; i < nb_args; ++i) {
+            key_hash(key.hash, args[i]);
+        }
+        args += nb_args;
+    }
+
+    return key;
+}
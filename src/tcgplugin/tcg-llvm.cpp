@@ -42,6 +42,7 @@ extern "C" {
 }
 
 #include "tcgplugin/tcg-llvm.h"
+#include "tcgplugin/tcg-llvm-key.h"
 
 extern "C" {
 #include "config.h"
@@ -85,6 +86,7 @@ extern "C" {
 #include <llvm/IR/DataLayout.h>
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/Transforms/Scalar.h>
+#include <llvm/Transforms/Utils/Cloning.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/Support/Threading.h>
 
@@ -93,6 +95,8 @@ extern "C" {
 
 #include <iostream>
 #include <sstream>
+#include <unordered_map>
+#include <list>
 
 using llvm::legacy::FunctionPassManager;
 using llvm::LLVMContext;
@@ -127,8 +131,9 @@ using llvm::sys::DynamicLibrary;
 using llvm::ArrayRef;
 using llvm::APInt;
 using llvm::ReturnInst;
-using llvm::llvm_start_multithreaded;
 using llvm::raw_string_ostream;
+using llvm::ValueToValueMapTy;
+using llvm::CloneFunction;
 namespace Intrinsic = llvm::Intrinsic;
 
 
@@ -187,6 +192,44 @@ struct TCGLLVMContextPrivate {
     /* Count of generated translation blocks */
     int m_tbCount;
 
+    /* Translations of the same block (same pc, flags and TCG code)
+       share one function. Each translation block holds a reference.
+       When the last one is released, the function goes to a bounded LRU
+       list of idle functions, because tb_flush drops all references
+       before the block gets translated again. */
+    struct SharedFunction {
+        TCGLLVMFunctionKey key;
+        unsigned refCount;
+
+        /* Position in m_idleFunctions, valid while refCount is 0 */
+        std::list<Function*>::iterator idlePos;
+
+        uint8_t *tcPtr;
+        ptrdiff_t tcSize;
+
+        /* Optimized copy for hot blocks, NULL until requested */
+        Function *optimized;
+
+        /* Estimated size of the IR of the function and its copy */
+        uint64_t irSize;
+    };
+
+    typedef std::unordered_map<TCGLLVMFunctionKey, Function*, TCGLLVMFunctionKeyHash> FunctionsByKey;
+    typedef std::unordered_map<Function*, SharedFunction> SharedFunctions;
+
+    FunctionsByKey m_functionsByKey;
+    SharedFunctions m_sharedFunctions;
+
+    /* Unreferenced functions, least recently released first */
+    std::list<Function*> m_idleFunctions;
+    size_t m_maxIdleFunctions;
+
+    uint64_t m_sharedFunctionHits;
+    uint64_t m_optimizedFunctions;
+
+    /* IR and native code of all shared functions, in bytes */
+    uint64_t m_functionBytes;
+
     /* XXX: The following members are "local" to generateCode method */
 
     /* TCGContext for current translation block */
@@ -309,7 +352,14 @@ public:
     inline Value *generateCondition(TCGCond cond, Value *arg1, Value *arg2);
     Value *generateAndC(TCGArg arg1, TCGArg arg2);
 
+    void generateFunction(TCGContext *s, TranslationBlock *tb,
+                          const std::string &name);
     void generateCode(TCGContext *s, TranslationBlock *tb);
+
+    Function *getOptimizedFunction(Function *function);
+    void releaseFunction(Function *function, std::vector<Function*> &evicted);
+    void evictFunction(Function *function, std::vector<Function*> &evicted);
+    void releaseBlock(TCGPluginTBData *data);
 };
 
 /* Custom JITMemoryManager in order to capture the size of
@@ -402,6 +452,8 @@ public:
 
 TCGLLVMContextPrivate::TCGLLVMContextPrivate()
     : m_context(getGlobalContext()), m_builder(m_context), m_tbCount(0),
+      m_maxIdleFunctions(4096), m_sharedFunctionHits(0), m_optimizedFunctions(0),
+      m_functionBytes(0),
       m_tcgContext(NULL), m_tbFunction(NULL)
 {
     std::memset(m_values, 0, sizeof(m_values));
@@ -435,6 +487,9 @@ TCGLLVMContextPrivate::TCGLLVMContextPrivate()
     m_functionPassManager->add(createCFGSimplificationPass());
     m_functionPassManager->add(createPromoteMemoryToRegisterPass());
 
+    //SelectRemovalPass lives in libs2e and turns selects into branches,
+    //which makes KLEE fork more often. S2EExecutor appends it to this
+    //pipeline only when -use-select-cleaner is set.
     //m_functionPassManager->add(new SelectRemovalPass());
 
     m_functionPassManager->doInitialization();
@@ -1420,23 +1475,14 @@ int TCGLLVMContextPrivate::generateOperation(int opc, const TCGArg *args)
     return nb_args;
 }
 
-void TCGLLVMContextPrivate::generateCode(TCGContext *s, TranslationBlock *tb)
+void TCGLLVMContextPrivate::generateFunction(TCGContext *s, TranslationBlock *tb,
+                                             const std::string &name)
 {
-	/* Create new function for current translation block */
-    /* TODO: compute the checksum of the tb to see if we can reuse some code */
-    std::ostringstream fName;
-    fName << "tcg-llvm-tb-" << (m_tbCount++) << "-" << std::hex << tb->pc;
-
-    /*
-    if(m_tbFunction)
-        m_tbFunction->eraseFromParent();
-    */
-
     FunctionType *tbFunctionType = FunctionType::get(
             wordType(),
             std::vector<llvm::Type*>(1, intPtrType(64)), false);
     m_tbFunction = Function::Create(tbFunctionType,
-            Function::PrivateLinkage, fName.str(), m_module);
+            Function::PrivateLinkage, name, m_module);
     BasicBlock *basicBlock = BasicBlock::Create(m_context,
             "entry", m_tbFunction);
     m_builder.SetInsertPoint(basicBlock);
@@ -1496,20 +1542,72 @@ void TCGLLVMContextPrivate::generateCode(TCGContext *s, TranslationBlock *tb)
 #ifndef NDEBUG
     verifyFunction(*m_tbFunction);
 #endif
+}
+
+/* LLVM does not track the memory used by a function, this counts
+   the fixed part of its values and their operand lists */
+static uint64_t estimateFunctionSize(const Function *function)
+{
+    uint64_t size = sizeof(Function);
+    for (Function::const_iterator bb = function->begin(); bb != function->end(); ++bb) {
+        size += sizeof(BasicBlock);
+        for (BasicBlock::const_iterator i = bb->begin(); i != bb->end(); ++i) {
+            size += sizeof(llvm::Instruction) + i->getNumOperands() * sizeof(llvm::Use);
+        }
+    }
+    return size;
+}
+
+void TCGLLVMContextPrivate::generateCode(TCGContext *s, TranslationBlock *tb)
+{
+    TCGLLVMFunctionKey key = TCGLLVMFunctionKey::compute(s, tb);
+
+    /* Retranslation of the same code (e.g., after a tb_flush) reuses
+       the existing function, which KLEE has probably prepared already */
+    FunctionsByKey::iterator it = m_functionsByKey.find(key);
+    if (it != m_functionsByKey.end()) {
+        m_tbFunction = it->second;
+        SharedFunction &shared = m_sharedFunctions[m_tbFunction];
+        if (shared.refCount++ == 0) {
+            m_idleFunctions.erase(shared.idlePos);
+        }
+        ++m_sharedFunctionHits;
+    } else {
+        /* Create new function for current translation block */
+        std::ostringstream fName;
+        fName << "tcg-llvm-tb-" << (m_tbCount++) << "-" << std::hex << tb->pc;
+
+        generateFunction(s, tb, fName.str());
+
+        SharedFunction &shared = m_sharedFunctions[m_tbFunction];
+        shared.key = key;
+        shared.refCount = 1;
+        shared.tcPtr = NULL;
+        shared.tcSize = 0;
+        shared.optimized = NULL;
+        shared.irSize = estimateFunctionSize(m_tbFunction);
+        m_functionBytes += shared.irSize;
+        m_functionsByKey[key] = m_tbFunction;
+    }
+
+    /* Functions are not optimized here, most blocks run only a few
+       times. See getOptimizedFunction for hot blocks. */
 
-    //KLEE will optimize the function later
-    //m_functionPassManager->run(*m_tbFunction);
-    
     assert(tb->tcg_plugin_opaque);
 
     static_cast<TCGPluginTBData *>(tb->tcg_plugin_opaque)->llvm_function = m_tbFunction;
 
     if(execute_llvm) {// || qemu_loglevel_mask(CPU_LOG_LLVM_ASM)) {
-        static_cast<TCGPluginTBData *>(tb->tcg_plugin_opaque)->llvm_tc_ptr = (uint8_t*)
-                m_executionEngine->getPointerToFunction(m_tbFunction);
-        static_cast<TCGPluginTBData *>(tb->tcg_plugin_opaque)->llvm_tc_end = 
-            static_cast<TCGPluginTBData *>(tb->tcg_plugin_opaque)->llvm_tc_ptr +
-                m_jitMemoryManager->getLastFunctionSize();
+        /* The JIT does not report the size of functions it compiled before */
+        SharedFunction &shared = m_sharedFunctions[m_tbFunction];
+        if (!shared.tcPtr) {
+            shared.tcPtr = (uint8_t*) m_executionEngine->getPointerToFunction(m_tbFunction);
+            shared.tcSize = m_jitMemoryManager->getLastFunctionSize();
+            m_functionBytes += shared.tcSize;
+        }
+        static_cast<TCGPluginTBData *>(tb->tcg_plugin_opaque)->llvm_tc_ptr = shared.tcPtr;
+        static_cast<TCGPluginTBData *>(tb->tcg_plugin_opaque)->llvm_tc_end =
+                shared.tcPtr + shared.tcSize;
     } else {
         static_cast<TCGPluginTBData *>(tb->tcg_plugin_opaque)->llvm_tc_ptr = 0;
         static_cast<TCGPluginTBData *>(tb->tcg_plugin_opaque)->llvm_tc_end = 0;
@@ -1540,6 +1638,88 @@ void TCGLLVMContextPrivate::generateCode(TCGContext *s, TranslationBlock *tb)
     } */
 }
 
+Function *TCGLLVMContextPrivate::getOptimizedFunction(Function *function)
+{
+    SharedFunctions::iterator it = m_sharedFunctions.find(function);
+    assert(it != m_sharedFunctions.end());
+    SharedFunction &shared = it->second;
+    if (shared.optimized) {
+        return shared.optimized;
+    }
+
+    /* The original function is left untouched, states that are
+       suspended in the middle of it keep executing its instructions */
+    ValueToValueMapTy vmap;
+    Function *optimized = CloneFunction(function, vmap, false);
+    optimized->setName(function->getName() + "-opt");
+    m_module->getFunctionList().push_back(optimized);
+
+    m_functionPassManager->run(*optimized);
+
+#ifndef NDEBUG
+    verifyFunction(*optimized);
+#endif
+
+    uint64_t size = estimateFunctionSize(optimized);
+    shared.irSize += size;
+    m_functionBytes += size;
+
+    shared.optimized = optimized;
+    ++m_optimizedFunctions;
+    return optimized;
+}
+
+void TCGLLVMContextPrivate::releaseFunction(Function *function,
+                                            std::vector<Function*> &evicted)
+{
+    SharedFunctions::iterator it = m_sharedFunctions.find(function);
+    if (it == m_sharedFunctions.end()) {
+        evicted.push_back(function);
+        return;
+    }
+
+    assert(it->second.refCount > 0);
+    if (--it->second.refCount > 0) {
+        return;
+    }
+
+    it->second.idlePos = m_idleFunctions.insert(m_idleFunctions.end(), function);
+    while (m_idleFunctions.size() > m_maxIdleFunctions) {
+        evictFunction(m_idleFunctions.front(), evicted);
+    }
+}
+
+void TCGLLVMContextPrivate::evictFunction(Function *function,
+                                          std::vector<Function*> &evicted)
+{
+    SharedFunctions::iterator it = m_sharedFunctions.find(function);
+    assert(it != m_sharedFunctions.end() && it->second.refCount == 0);
+    SharedFunction &shared = it->second;
+
+    m_idleFunctions.erase(shared.idlePos);
+    m_functionBytes -= shared.irSize + shared.tcSize;
+
+    evicted.push_back(function);
+    if (shared.optimized) {
+        evicted.push_back(shared.optimized);
+    }
+
+    m_functionsByKey.erase(shared.key);
+    m_sharedFunctions.erase(it);
+}
+
+void TCGLLVMContextPrivate::releaseBlock(TCGPluginTBData *data)
+{
+    std::vector<Function*> evicted;
+    releaseFunction(data->llvm_function, evicted);
+    for (unsigned i = 0; i < evicted.size(); ++i) {
+        if (execute_llvm && m_executionEngine) {
+            m_executionEngine->freeMachineCodeForFunction(evicted[i]);
+        }
+        evicted[i]->eraseFromParent();
+    }
+}
+
 /***********************************/
 /* External interface for C++ code */
 
@@ -1578,6 +1758,42 @@ ExecutionEngine* TCGLLVMContext::getExecutionEngine()
     return m_private->m_executionEngine;
 }
 
+void TCGLLVMContext::releaseFunction(Function *function,
+                                     std::vector<Function*> &evicted)
+{
+    m_private->releaseFunction(function, evicted);
+}
+
+Function *TCGLLVMContext::getOptimizedFunction(Function *function)
+{
+    return m_private->getOptimizedFunction(function);
+}
+
+uint64_t TCGLLVMContext::getOptimizedFunctions() const
+{
+    return m_private->m_optimizedFunctions;
+}
+
+void TCGLLVMContext::releaseBlock(TCGPluginTBData *data)
+{
+    m_private->releaseBlock(data);
+}
+
+void TCGLLVMContext::setMaxIdleFunctions(size_t count)
+{
+    m_private->m_maxIdleFunctions = count;
+}
+
+uint64_t TCGLLVMContext::getSharedFunctionHits() const
+{
+    return m_private->m_sharedFunctionHits;
+}
+
+uint64_t TCGLLVMContext::getFunctionBytes() const
+{
+    return m_private->m_functionBytes;
+}
+
 #ifdef CONFIG_S2E
 void TCGLLVMContext::initializeHelpers()
 {
@@ -1625,14 +1841,22 @@ void tcg_llvm_tb_alloc(TranslationBlock *tb)
     assert(tb->tcg_plugin_opaque);
     static_cast<TCGPluginTBData *>(tb->tcg_plugin_opaque)->tcg_llvm_context = NULL;
     static_cast<TCGPluginTBData *>(tb->tcg_plugin_opaque)->llvm_function = NULL;
+    static_cast<TCGPluginTBData *>(tb->tcg_plugin_opaque)->llvm_optimized_function = NULL;
+    static_cast<TCGPluginTBData *>(tb->tcg_plugin_opaque)->execution_count = 0;
 }
 
 void tcg_llvm_tb_free(TranslationBlock *tb)
 {
     assert(tb->tcg_plugin_opaque);
-    if(static_cast<TCGPluginTBData *>(tb->tcg_plugin_opaque)->llvm_function) {
-        static_cast<TCGPluginTBData *>(tb->tcg_plugin_opaque)->llvm_function->eraseFromParent();
+#ifndef CONFIG_S2E
+    /* With S2E, the reference of the block is owned by its
+       S2ETranslationBlock and released in S2EExecutor::unrefS2ETb */
+    TCGPluginTBData *data = static_cast<TCGPluginTBData *>(tb->tcg_plugin_opaque);
+    if(data->llvm_function) {
+        data->tcg_llvm_context->releaseBlock(data);
+        data->llvm_function = NULL;
     }
+#endif
 }
 
 #ifndef CONFIG_S2E